@@ -0,0 +1,35 @@
+/*
+ * byteswap.h
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UR_BYTESWAP_H_
+#define UR_BYTESWAP_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/*
+ * Converts count contiguous big-endian doubles starting at src to host
+ * order in one pass. src doesn't need to be aligned. Uses AVX2, SSSE3 or
+ * SSE2 shuffles when the compiler targets them, and a scalar loop otherwise.
+ */
+void unpack_be_doubles(const uint8_t * src, double * dst, size_t count);
+
+/* Name of the kernel unpack_be_doubles was compiled with */
+const char* unpack_be_doubles_kernel();
+
+#endif /* UR_BYTESWAP_H_ */
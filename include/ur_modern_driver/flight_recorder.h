@@ -0,0 +1,110 @@
+/*
+ * flight_recorder.h
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UR_FLIGHT_RECORDER_H_
+#define UR_FLIGHT_RECORDER_H_
+
+#include "robot_state_RT.h"
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+enum flight_record_type {
+	FLIGHT_RECORD_RT = 1, //decoded RT packet
+	FLIGHT_RECORD_SERVOJ = 2, //servoj frame sent on the reverse socket
+	FLIGHT_RECORD_SPEEDJ = 3 //speedj sent by setSpeed
+};
+
+/*
+ * One fixed-size entry of the ring. All fields are in host byte order.
+ *
+ * RT:     count = packet sequence, time = controller time, values =
+ *         q_target, qd_target, q_actual, qd_actual, i_actual, tcp_force
+ * SERVOJ: count = setpoints in values (6 doubles each), time = trajectory time
+ * SPEEDJ: count = 1, time = acceleration, values[0..5] = joint speeds
+ */
+struct flight_record {
+	uint64_t stamp; //slot index + 1, written last. 0 or stale while the slot is being written
+	uint64_t time_ns; //CLOCK_MONOTONIC of the host
+	uint32_t type;
+	uint32_t count;
+	double time;
+	double robot_mode;
+	double safety_mode;
+	double speed_scaling;
+	double values[36];
+};
+
+/*
+ * Memory and dump layout: "URFLTREC", then uint32 format version, record
+ * size and capacity, uint64 number of records written so far, padded to 64
+ * bytes, and then the ring of capacity records. Record i lives in slot
+ * i % capacity.
+ */
+struct flight_recorder_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t capacity;
+	uint32_t reserved;
+	uint64_t head; //only accessed with __atomic builtins in the ring
+	uint8_t padding[32];
+};
+
+/*
+ * Always-on recorder of the last capacity RT packets and commanded
+ * setpoints. The ring is anonymous memory faulted in by open(), so
+ * recording is a couple of stores into memory. Only dump() touches the
+ * file system: it copies the ring in chronological order to a file, e.g.
+ * on a protective stop. A file backed ring would survive a crash, but
+ * writeback makes its pages fault again on the receive thread.
+ *
+ * record*() may be called from any thread and never block.
+ */
+class FlightRecorder {
+private:
+	std::string path_;
+	flight_recorder_header* header_;
+	flight_record* ring_;
+	size_t map_len_;
+	uint32_t capacity_;
+
+	flight_record* claim(flight_record_type type, uint64_t& index);
+	void commit(flight_record* r, uint64_t index);
+
+public:
+	FlightRecorder();
+	~FlightRecorder();
+	bool open(const std::string& path, uint32_t capacity);
+	void close();
+	bool isOpen();
+
+	void recordRT(const robot_state_rt_data& data);
+	void recordServo(const double* points, int n, double t);
+	void recordSpeed(const double* qd, double acc);
+
+	/* Writes the ring oldest first to path. Returns the number of records written, -1 on error */
+	long dump(const std::string& path);
+	/* Writes to <path given to open()>.<local time>.dump and returns its name, empty on error */
+	std::string dump();
+
+	/* Reads a ring or a dump, oldest record first */
+	static bool read(const std::string& path, std::vector<flight_record>& records);
+};
+
+#endif /* UR_FLIGHT_RECORDER_H_ */
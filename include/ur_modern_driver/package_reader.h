@@ -0,0 +1,119 @@
+/*
+ * package_reader.h
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UR_PACKAGE_READER_H_
+#define UR_PACKAGE_READER_H_
+
+#include "byteswap.h"
+#include <inttypes.h>
+#include <string.h>
+#include <endian.h>
+
+/*
+ * Reads big-endian fields straight out of a received package. Reading
+ * past the end returns zeros and clears ok(), so a decoder can read all
+ * of its fields and check once at the end whether the package was long
+ * enough.
+ */
+class PackageReader {
+private:
+	const uint8_t * buf_;
+	uint32_t len_;
+	uint32_t offset_;
+	bool ok_;
+
+	bool take(uint32_t n) {
+		if (!ok_ || len_ - offset_ < n) {
+			ok_ = false;
+			return false;
+		}
+		return true;
+	}
+
+public:
+	PackageReader(const uint8_t * buf, uint32_t len) :
+			buf_(buf), len_(len), offset_(0), ok_(true) {
+	}
+
+	bool ok() const {
+		return ok_;
+	}
+
+	uint32_t remaining() const {
+		return ok_ ? len_ - offset_ : 0;
+	}
+
+	void skip(uint32_t n) {
+		if (take(n))
+			offset_ += n;
+	}
+
+	uint8_t u8() {
+		if (!take(1))
+			return 0;
+		return buf_[offset_++];
+	}
+
+	int8_t i8() {
+		return (int8_t) u8();
+	}
+
+	uint32_t u32() {
+		uint32_t v;
+		if (!take(sizeof(v)))
+			return 0;
+		memcpy(&v, &buf_[offset_], sizeof(v));
+		offset_ += sizeof(v);
+		return be32toh(v);
+	}
+
+	int32_t i32() {
+		return (int32_t) u32();
+	}
+
+	float f32() {
+		uint32_t v = u32();
+		float f;
+		memcpy(&f, &v, sizeof(f));
+		return f;
+	}
+
+	double f64() {
+		uint64_t v;
+		double d;
+		if (!take(sizeof(v)))
+			return 0.;
+		memcpy(&v, &buf_[offset_], sizeof(v));
+		offset_ += sizeof(v);
+		v = be64toh(v);
+		memcpy(&d, &v, sizeof(d));
+		return d;
+	}
+
+	/* count contiguous doubles, byte swapped in one pass */
+	void f64s(double * dst, uint32_t count) {
+		if (!take(count * sizeof(double))) {
+			memset(dst, 0, count * sizeof(double));
+			return;
+		}
+		unpack_be_doubles(&buf_[offset_], dst, count);
+		offset_ += count * sizeof(double);
+	}
+};
+
+#endif /* UR_PACKAGE_READER_H_ */
@@ -0,0 +1,253 @@
+/*
+ * package_view.h
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UR_PACKAGE_VIEW_H_
+#define UR_PACKAGE_VIEW_H_
+
+#include "packet_pool.h"
+#include <inttypes.h>
+#include <string.h>
+#include <endian.h>
+
+/*
+ * One package of a received robot state message, read in place. The view
+ * keeps the pooled message alive, and a field is only byte swapped when it
+ * is asked for. Packages are checked for their length when the message is
+ * received, so the accessors never read past the package. An empty view
+ * (no package received yet) reads as zeros.
+ */
+class PackageView {
+protected:
+	PacketRef packet_;
+	const uint8_t * body_; //after the 5 byte package header
+	uint32_t len_;
+
+	uint8_t u8(uint32_t offset) const {
+		return body_ == NULL ? 0 : body_[offset];
+	}
+	uint16_t u16(uint32_t offset) const {
+		uint16_t v;
+		if (body_ == NULL)
+			return 0;
+		memcpy(&v, &body_[offset], sizeof(v));
+		return be16toh(v);
+	}
+	uint32_t u32(uint32_t offset) const {
+		uint32_t v;
+		if (body_ == NULL)
+			return 0;
+		memcpy(&v, &body_[offset], sizeof(v));
+		return be32toh(v);
+	}
+	float f32(uint32_t offset) const {
+		uint32_t v = u32(offset);
+		float f;
+		memcpy(&f, &v, sizeof(f));
+		return f;
+	}
+	double f64(uint32_t offset) const {
+		uint64_t v;
+		double d;
+		if (body_ == NULL)
+			return 0.;
+		memcpy(&v, &body_[offset], sizeof(v));
+		v = be64toh(v);
+		memcpy(&d, &v, sizeof(d));
+		return d;
+	}
+
+public:
+	PackageView() :
+			body_(NULL), len_(0) {
+	}
+	PackageView(const PacketRef& packet, uint32_t offset, uint32_t len) :
+			packet_(packet), body_(packet.data() + offset), len_(len) {
+	}
+
+	void swap(PackageView& other) {
+		const uint8_t * body = body_;
+		uint32_t len = len_;
+		packet_.swap(other.packet_);
+		body_ = other.body_;
+		len_ = other.len_;
+		other.body_ = body;
+		other.len_ = len;
+	}
+
+	bool valid() const {
+		return body_ != NULL;
+	}
+	const uint8_t * body() const {
+		return body_;
+	}
+	uint32_t length() const {
+		return len_;
+	}
+};
+
+/* Robot mode data. Firmware before 2.0 has no control mode and target speed fraction */
+class RobotModeView: public PackageView {
+private:
+	bool has_control_mode_;
+
+public:
+	RobotModeView() :
+			has_control_mode_(true) {
+	}
+	RobotModeView(const PackageView& package, double version) :
+			PackageView(package), has_control_mode_(version > 2.) {
+	}
+
+	static bool complete(uint32_t len, double version) {
+		return len >= (version > 2. ? 33u : 24u);
+	}
+
+	uint64_t timestamp() const {
+		return ((uint64_t) u32(0) << 32) | u32(4);
+	}
+	bool isRobotConnected() const {
+		return u8(8) > 0;
+	}
+	bool isRealRobotEnabled() const {
+		return u8(9) > 0;
+	}
+	bool isPowerOnRobot() const {
+		return u8(10) > 0;
+	}
+	bool isEmergencyStopped() const {
+		return u8(11) > 0;
+	}
+	bool isProtectiveStopped() const {
+		return u8(12) > 0;
+	}
+	bool isProgramRunning() const {
+		return u8(13) > 0;
+	}
+	bool isProgramPaused() const {
+		return u8(14) > 0;
+	}
+	unsigned char robotMode() const {
+		return u8(15);
+	}
+	unsigned char controlMode() const {
+		return has_control_mode_ ? u8(16) : 0;
+	}
+	double targetSpeedFraction() const {
+		return has_control_mode_ ? f64(17) : 0.;
+	}
+	double speedScaling() const {
+		return f64(has_control_mode_ ? 25 : 16);
+	}
+};
+
+/*
+ * Masterboard data. Firmware before 3.0 sends 16 bit digital IO and
+ * euromap voltage and current, which moves everything after them.
+ */
+class MasterboardView: public PackageView {
+private:
+	bool v3_;
+	uint32_t o_; //offset of analogInputRange0
+
+public:
+	MasterboardView() :
+			v3_(true), o_(8) {
+	}
+	MasterboardView(const PackageView& package, double version) :
+			PackageView(package), v3_(version >= 3.0), o_(v3_ ? 8 : 4) {
+	}
+
+	static bool complete(const uint8_t * body, uint32_t len, double version) {
+		uint32_t o = version >= 3.0 ? 8 : 4;
+		if (len < o + 55)
+			return false;
+		if (body[o + 54] == 0)
+			return true;
+		return len >= o + 55 + (version >= 3.0 ? 16 : 12);
+	}
+
+	int digitalInputBits() const {
+		return v3_ ? (int) u32(0) : (uint16_t) u16(0);
+	}
+	int digitalOutputBits() const {
+		return v3_ ? (int) u32(4) : (uint16_t) u16(2);
+	}
+	char analogInputRange0() const {
+		return u8(o_);
+	}
+	char analogInputRange1() const {
+		return u8(o_ + 1);
+	}
+	double analogInput0() const {
+		return f64(o_ + 2);
+	}
+	double analogInput1() const {
+		return f64(o_ + 10);
+	}
+	char analogOutputDomain0() const {
+		return u8(o_ + 18);
+	}
+	char analogOutputDomain1() const {
+		return u8(o_ + 19);
+	}
+	double analogOutput0() const {
+		return f64(o_ + 20);
+	}
+	double analogOutput1() const {
+		return f64(o_ + 28);
+	}
+	float masterBoardTemperature() const {
+		return f32(o_ + 36);
+	}
+	float robotVoltage48V() const {
+		return f32(o_ + 40);
+	}
+	float robotCurrent() const {
+		return f32(o_ + 44);
+	}
+	float masterIOCurrent() const {
+		return f32(o_ + 48);
+	}
+	unsigned char safetyMode() const {
+		return u8(o_ + 52);
+	}
+	unsigned char masterOnOffState() const {
+		return u8(o_ + 53);
+	}
+	char euromap67InterfaceInstalled() const {
+		return u8(o_ + 54);
+	}
+	int euromapInputBits() const {
+		return euromap67InterfaceInstalled() ? (int) u32(o_ + 55) : 0;
+	}
+	int euromapOutputBits() const {
+		return euromap67InterfaceInstalled() ? (int) u32(o_ + 59) : 0;
+	}
+	float euromapVoltage() const {
+		if (!euromap67InterfaceInstalled())
+			return 0.;
+		return v3_ ? f32(o_ + 63) : (uint16_t) u16(o_ + 63);
+	}
+	float euromapCurrent() const {
+		if (!euromap67InterfaceInstalled())
+			return 0.;
+		return v3_ ? f32(o_ + 67) : (uint16_t) u16(o_ + 65);
+	}
+};
+
+#endif /* UR_PACKAGE_VIEW_H_ */
@@ -0,0 +1,75 @@
+/*
+ * packet_framer.h
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UR_PACKET_FRAMER_H_
+#define UR_PACKET_FRAMER_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <vector>
+#include <atomic>
+
+/*
+ * Reassembles the packets of a TCP stream where every packet starts with its
+ * total length as a 4 byte big-endian integer (the format of both the RT and
+ * the secondary interface).
+ *
+ * Data is read straight into the buffer (writePtr()/writeSpace(), then
+ * commit()), and every complete packet is handed out contiguously by next().
+ * The bytes of an incomplete packet are moved to the front of the buffer
+ * when more space is needed, so packets are never split.
+ *
+ * After a length prefix that can't be valid there is nothing to find the
+ * next packet boundary on. The framer then stops handing out packets and
+ * failed() is true until reset(); the caller should reconnect, so the
+ * stream starts at a packet boundary again.
+ */
+class PacketFramer {
+private:
+	std::vector<uint8_t> buf_;
+	uint32_t max_packet_length_;
+	size_t head_; //first byte not handed out yet
+	size_t tail_; //end of the received data
+	unsigned int packets_since_commit_;
+	bool read_accounted_;
+	bool failed_;
+
+	std::atomic<unsigned long> packets_;
+	std::atomic<unsigned long> partial_reads_;
+	std::atomic<unsigned long> coalesced_reads_;
+	std::atomic<unsigned long> framing_errors_;
+
+	void accountRead();
+
+public:
+	PacketFramer(uint32_t max_packet_length = 2048);
+
+	uint8_t* writePtr();
+	size_t writeSpace();
+	void commit(size_t bytes_read);
+	bool next(uint8_t*& packet, uint32_t& len);
+	void reset();
+	bool failed();
+
+	unsigned long getPackets();
+	unsigned long getPartialReads(); //reads that ended inside a packet
+	unsigned long getCoalescedReads(); //reads that completed more than one packet
+	unsigned long getFramingErrors(); //length prefixes that could not be valid
+};
+
+#endif /* UR_PACKET_FRAMER_H_ */
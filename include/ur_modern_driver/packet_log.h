@@ -0,0 +1,96 @@
+/*
+ * packet_log.h
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UR_PACKET_LOG_H_
+#define UR_PACKET_LOG_H_
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+/*
+ * Raw bytes received from the controller, one record per read() as it
+ * came from the socket, so a replay goes through the same framing.
+ *
+ * File: "URPKTLOG", uint32 format version, then records of
+ * [uint8 channel][uint32 length][uint64 ns since the log was opened][bytes].
+ * All integers are little-endian.
+ *
+ * write() only appends to a memory buffer, a writer thread puts it on disk,
+ * so the socket threads never wait for file I/O. Both buffers are allocated
+ * by open(), records that don't fit are dropped instead of growing them.
+ */
+enum packet_log_channel {
+	PACKET_LOG_PRIMARY = 1, //30001, read once for the firmware version
+	PACKET_LOG_SECONDARY = 2, //30002
+	PACKET_LOG_REALTIME = 3 //30003
+};
+
+struct packet_log_record {
+	uint8_t channel;
+	uint64_t time_ns;
+	std::vector<uint8_t> data;
+};
+
+class PacketLogWriter {
+private:
+	FILE* file_;
+	std::mutex lock_; //the channels are written from different threads
+	std::condition_variable cond_;
+	std::thread thread_;
+	bool running_;
+	std::vector<uint8_t> pending_; //records not handed to the writer thread yet
+	std::vector<uint8_t> batch_; //records being written by the writer thread
+	uint64_t start_ns_;
+	unsigned long records_;
+	unsigned long dropped_; //records lost because the disk didn't keep up
+	uint64_t bytes_;
+
+	void writerThread();
+
+public:
+	PacketLogWriter();
+	~PacketLogWriter();
+	bool open(const std::string& path);
+	void close();
+	void write(packet_log_channel channel, const uint8_t* data, uint32_t len);
+	unsigned long getRecords();
+	unsigned long getDropped();
+	uint64_t getBytes();
+};
+
+class PacketLogReader {
+private:
+	FILE* file_;
+	long size_; //of the file, bounds the record lengths
+
+public:
+	PacketLogReader();
+	~PacketLogReader();
+	bool open(const std::string& path);
+	void close();
+	/* Returns false at the end of the log or on a truncated record */
+	bool next(packet_log_record& record);
+	void rewind();
+};
+
+#endif /* UR_PACKET_LOG_H_ */
@@ -0,0 +1,96 @@
+/*
+ * packet_pool.h
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UR_PACKET_POOL_H_
+#define UR_PACKET_POOL_H_
+
+#include <atomic>
+#include <inttypes.h>
+#include <stddef.h>
+#include <mutex>
+#include <vector>
+
+class PacketPool;
+
+struct pooled_buffer {
+	std::atomic<unsigned int> refs;
+	PacketPool* pool;
+	uint32_t len;
+	uint8_t* data;
+};
+
+/*
+ * Counted reference to a received packet in a PacketPool. The buffer goes
+ * back to the pool when the last reference is dropped, from whichever
+ * thread that happens to be.
+ */
+class PacketRef {
+private:
+	pooled_buffer* buf_;
+
+public:
+	PacketRef() :
+			buf_(NULL) {
+	}
+	explicit PacketRef(pooled_buffer* buf); //takes over the first reference
+	PacketRef(const PacketRef& other);
+	PacketRef& operator=(const PacketRef& other);
+	~PacketRef();
+
+	void reset();
+	void swap(PacketRef& other);
+
+	bool empty() const {
+		return buf_ == NULL;
+	}
+	const uint8_t* data() const {
+		return buf_ == NULL ? NULL : buf_->data;
+	}
+	uint32_t size() const {
+		return buf_ == NULL ? 0 : buf_->len;
+	}
+};
+
+/*
+ * Fixed size buffers for received packets, reused instead of allocated per
+ * packet. When all buffers are referenced a new one is allocated, so the
+ * pool settles at the number of packets its users hold at once. The pool
+ * must outlive every PacketRef to its buffers.
+ */
+class PacketPool {
+private:
+	std::mutex lock_; //protects free_ and all_
+	std::vector<pooled_buffer*> free_;
+	std::vector<pooled_buffer*> all_;
+	uint32_t buffer_size_;
+
+	pooled_buffer* allocate();
+
+public:
+	PacketPool(uint32_t buffer_size, unsigned int count);
+	~PacketPool();
+
+	/* Copies the packet into a buffer. Empty if it doesn't fit one */
+	PacketRef copy(const uint8_t* packet, uint32_t len);
+	void release(pooled_buffer* buf);
+
+	unsigned int getBuffers(); //allocated so far
+	uint32_t getBufferSize();
+};
+
+#endif /* UR_PACKET_POOL_H_ */
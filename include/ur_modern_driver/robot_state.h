@@ -26,6 +26,10 @@
 #include <mutex>
 #include <condition_variable>
 #include <netinet/in.h>
+#include <atomic>
+#include "secondary_state.h"
+#include "package_view.h"
+#include "packet_pool.h"
 
 namespace message_types {
 enum message_type {
@@ -109,59 +113,32 @@ struct version_message {
 	char build_date[25];
 };
 
-struct masterboard_data {
-	int digitalInputBits;
-	int digitalOutputBits;
-	char analogInputRange0;
-	char analogInputRange1;
-	double analogInput0;
-	double analogInput1;
-	char analogOutputDomain0;
-	char analogOutputDomain1;
-	double analogOutput0;
-	double analogOutput1;
-	float masterBoardTemperature;
-	float robotVoltage48V;
-	float robotCurrent;
-	float masterIOCurrent;
-	unsigned char safetyMode;
-	unsigned char masterOnOffState;
-	char euromap67InterfaceInstalled;
-	int euromapInputBits;
-	int euromapOutputBits;
-	float euromapVoltage;
-	float euromapCurrent;
-};
-
-struct robot_mode_data {
-	uint64_t timestamp;
-	bool isRobotConnected;
-	bool isRealRobotEnabled;
-	bool isPowerOnRobot;
-	bool isEmergencyStopped;
-	bool isProtectiveStopped;
-	bool isProgramRunning;
-	bool isProgramPaused;
-	unsigned char robotMode;
-	unsigned char controlMode;
-	double targetSpeedFraction;
-	double speedScaling;
+/* Masterboard IO of one packet, see RobotState::getIOState() */
+struct io_state {
+	uint32_t digital_inputs; //bit i is pin i
+	uint32_t digital_outputs;
+	double analog_inputs[2];
+	double analog_outputs[2];
 };
 
 class RobotState {
 private:
+	static const unsigned int PACKAGE_TYPES = 10; //ROBOT_MODE_DATA .. CALIBRATION_DATA
+
 	version_message version_msg_;
-	masterboard_data mb_data_;
-	robot_mode_data robot_mode_;
+	std::mutex val_lock_; // Locks version_msg_
 
-	std::recursive_mutex val_lock_; // Locks the variables while unpack parses data;
+	PacketPool pool_; //Received robot state messages, referenced by the views
+	std::mutex view_lock_; //Only held to copy or swap the views below
+	PackageView packages_[PACKAGE_TYPES]; //Last complete package of each type
+	double view_version_; //Firmware version the packages were checked against
+	uint64_t sequence_; //Robot state messages received before the current one
+	std::atomic<unsigned long> decode_errors_; //Packages too short for their type
 
 	std::condition_variable* pMsg_cond_; //Signals that new vars are available
 	bool new_data_available_; //to avoid spurious wakes
 	unsigned char robot_mode_running_;
 
-	double ntohd(uint64_t nf);
-
 public:
 	RobotState(std::condition_variable& msg_cond);
 	~RobotState();
@@ -178,6 +155,11 @@ public:
 	char getAnalogOutputDomain1();
 	double getAnalogOutput0();
 	double getAnalogOutput1();
+	void getIOState(io_state& io);
+	RobotModeView getRobotModeView();
+	MasterboardView getMasterboardView();
+	void snapshot(secondary_state_data& ret);
+	unsigned long getDecodeErrors();
 	std::vector<double> getVActual();
 	float getMasterBoardTemperature();
 	float getRobotVoltage48V();
@@ -211,8 +193,6 @@ public:
 	void unpackRobotMessageVersion(uint8_t * buf, unsigned int offset,
 			uint32_t len);
 	void unpackRobotState(uint8_t * buf, unsigned int offset, uint32_t len);
-	void unpackRobotStateMasterboard(uint8_t * buf, unsigned int offset);
-	void unpackRobotMode(uint8_t * buf, unsigned int offset);
 };
 
 #endif /* ROBOT_STATE_H_ */
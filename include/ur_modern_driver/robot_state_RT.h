@@ -21,60 +21,83 @@
 
 #include <inttypes.h>
 #include <vector>
+#include <array>
 #include <stdlib.h>
 #include <string.h>
 #include <mutex>
 #include <netinet/in.h>
 #include <condition_variable>
+#include <atomic>
+#include "seqlock.h"
+#include "spsc_queue.h"
 
-class RobotStateRT {
-private:
-	double version_; //protocol version
+class FlightRecorder;
+
+struct robot_state_rt_data {
+	uint64_t sequence; //Number of packets decoded before this one. Gaps seen by a reader are packets it missed
+	double time; //Time elapsed since the controller was started
+	std::array<double, 6> q_target; //Target joint positions
+	std::array<double, 6> qd_target; //Target joint velocities
+	std::array<double, 6> qdd_target; //Target joint accelerations
+	std::array<double, 6> i_target; //Target joint currents
+	std::array<double, 6> m_target; //Target joint moments (torques)
+	std::array<double, 6> q_actual; //Actual joint positions
+	std::array<double, 6> qd_actual; //Actual joint velocities
+	std::array<double, 6> i_actual; //Actual joint currents
+	std::array<double, 6> i_control; //Joint control currents
+	std::array<double, 6> tool_vector_actual; //Actual Cartesian coordinates of the tool: (x,y,z,rx,ry,rz), where rx, ry and rz is a rotation vector representation of the tool orientation
+	std::array<double, 6> tcp_speed_actual; //Actual speed of the tool given in Cartesian coordinates
+	std::array<double, 6> tcp_force; //Generalised forces in the TC
+	std::array<double, 6> tool_vector_target; //Target Cartesian coordinates of the tool: (x,y,z,rx,ry,rz), where rx, ry and rz is a rotation vector representation of the tool orientation
+	std::array<double, 6> tcp_speed_target; //Target speed of the tool given in Cartesian coordinates
+	uint64_t digital_input_bits; //Current state of the digital inputs. NOTE: these are bits encoded as int64_t, e.g. a value of 5 corresponds to bit 0 and bit 2 set high
+	std::array<double, 6> motor_temperatures; //Temperature of each joint in degrees celsius
+	double controller_timer; //Controller realtime thread execution time
+	double robot_mode; //Robot mode
+	std::array<double, 6> joint_modes; //Joint control modes
+	double safety_mode; //Safety mode
+	std::array<double, 3> tool_accelerometer_values; //Tool x,y and z accelerometer values (software version 1.7)
+	double speed_scaling; //Speed scaling of the trajectory limiter
+	double linear_momentum_norm; //Norm of Cartesian linear momentum
+	double v_main; //Masterboard: Main voltage
+	double v_robot; //Matorborad: Robot voltage (48V)
+	double i_robot; //Masterboard: Robot current
+	std::array<double, 6> v_actual; //Actual joint voltages
+	double digital_outputs; //Digital outputs (software version 3.2)
+	double program_state; //Program state (software version 3.2)
+	std::array<double, 3> elbow_position; //Elbow position (software version 3.5)
+	std::array<double, 3> elbow_velocity; //Elbow velocity (software version 3.5)
+};
 
-	double time_; //Time elapsed since the controller was started
-	std::vector<double> q_target_; //Target joint positions
-	std::vector<double> qd_target_; //Target joint velocities
-	std::vector<double> qdd_target_; //Target joint accelerations
-	std::vector<double> i_target_; //Target joint currents
-	std::vector<double> m_target_; //Target joint moments (torques)
-	std::vector<double> q_actual_; //Actual joint positions
-	std::vector<double> qd_actual_; //Actual joint velocities
-	std::vector<double> i_actual_; //Actual joint currents
-	std::vector<double> i_control_; //Joint control currents
-	std::vector<double> tool_vector_actual_; //Actual Cartesian coordinates of the tool: (x,y,z,rx,ry,rz), where rx, ry and rz is a rotation vector representation of the tool orientation
-	std::vector<double> tcp_speed_actual_; //Actual speed of the tool given in Cartesian coordinates
-	std::vector<double> tcp_force_; //Generalised forces in the TC
-	std::vector<double> tool_vector_target_; //Target Cartesian coordinates of the tool: (x,y,z,rx,ry,rz), where rx, ry and rz is a rotation vector representation of the tool orientation
-	std::vector<double> tcp_speed_target_; //Target speed of the tool given in Cartesian coordinates
-	std::vector<bool> digital_input_bits_; //Current state of the digital inputs. NOTE: these are bits encoded as int64_t, e.g. a value of 5 corresponds to bit 0 and bit 2 set high
-	std::vector<double> motor_temperatures_; //Temperature of each joint in degrees celsius
-	double controller_timer_; //Controller realtime thread execution time
-	double robot_mode_; //Robot mode
-	std::vector<double> joint_modes_; //Joint control modes
-	double safety_mode_; //Safety mode
-	std::vector<double> tool_accelerometer_values_; //Tool x,y and z accelerometer values (software version 1.7)
-	double speed_scaling_; //Speed scaling of the trajectory limiter
-	double linear_momentum_norm_; //Norm of Cartesian linear momentum
-	double v_main_; //Masterboard: Main voltage
-	double v_robot_; //Matorborad: Robot voltage (48V)
-	double i_robot_; //Masterboard: Robot current
-	std::vector<double> v_actual_; //Actual joint voltages
+/* Every decoded packet for one consumer thread, see RobotStateRT::addConsumer() */
+typedef SpscQueue<robot_state_rt_data, 64> rt_snapshot_queue;
 
-	std::mutex val_lock_; // Locks the variables while unpack parses data;
+/* Decodes a length checked RT packet into data. Returns false if len doesn't fit the layout */
+typedef bool (*rt_packet_decoder)(uint8_t * buf, int len,
+		robot_state_rt_data& data);
+
+class RobotStateRT {
+private:
+	std::atomic<double> version_; //protocol version
+	robot_state_rt_data data_; //Decoded in place by unpack, so no allocations happen per packet. Only touched by the receiving thread
+	uint64_t sequence_; //Sequence number given to the next decoded packet
+	rt_packet_decoder decoder_; //Packet layout of the connected firmware, chosen by selectLayout()
+	SeqLock<robot_state_rt_data> state_; //Last complete packet, published wait-free to the readers
+	FlightRecorder* recorder_; //NULL unless every decoded packet is recorded
+	std::vector<rt_snapshot_queue*> consumers_; //Each gets a copy of every decoded packet
 
 	std::condition_variable* pMsg_cond_; //Signals that new vars are available
 	bool data_published_; //to avoid spurious wakes
 	bool controller_updated_; //to avoid spurious wakes
 
-	std::vector<double> unpackVector(uint8_t * buf, int start_index,
-			int nr_of_vals);
-	std::vector<bool> unpackDigitalInputBits(int64_t data);
-	double ntohd(uint64_t nf);
+	std::vector<bool> unpackDigitalInputBits(uint64_t data);
 
 public:
 	RobotStateRT(std::condition_variable& msg_cond);
 	~RobotStateRT();
 	double getVersion();
+	robot_state_rt_data snapshot();
+	void snapshot(robot_state_rt_data& ret);
 	double getTime();
 	std::vector<double> getQTarget();
 	std::vector<double> getQdTarget();
@@ -104,6 +127,10 @@ public:
 	double getIRobot();
 
 	void setVersion(double ver);
+	bool selectLayout();
+	void setFlightRecorder(FlightRecorder* recorder);
+	/* Must be called before packets are received. The queue is not owned */
+	void addConsumer(rt_snapshot_queue* queue);
 
 	void setDataPublished();
 	bool getDataPublished();
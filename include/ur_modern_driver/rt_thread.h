@@ -0,0 +1,56 @@
+/*
+ * rt_thread.h
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UR_RT_THREAD_H_
+#define UR_RT_THREAD_H_
+
+#include "do_output.h"
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+/*
+ * Scheduling settings for the threads that must keep up with the robot
+ * (socket reactor, ros_control loop, trajectory streaming).
+ *
+ * priority is a SCHED_FIFO priority (1-99), 0 leaves the thread under the
+ * normal scheduler. An empty cpu list leaves the affinity alone.
+ */
+struct rt_thread_config {
+	int priority;
+	std::vector<int> cpus;
+	bool lock_memory;
+
+	rt_thread_config() :
+			priority(0), lock_memory(false) {
+	}
+};
+
+/*
+ * Each of these only warns and returns false when the settings can't be
+ * applied (typically missing CAP_SYS_NICE / rtprio limits), the thread
+ * then just keeps running with its current settings.
+ */
+bool setRealtimePriority(pthread_t thread, int priority, std::string name);
+bool setCpuAffinity(pthread_t thread, const std::vector<int>& cpus,
+		std::string name);
+bool applyRealtimeConfig(pthread_t thread, const rt_thread_config& config,
+		std::string name);
+bool lockMemory();
+
+#endif /* UR_RT_THREAD_H_ */
@@ -0,0 +1,130 @@
+/*
+ * secondary_state.h
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UR_SECONDARY_STATE_H_
+#define UR_SECONDARY_STATE_H_
+
+#include <inttypes.h>
+
+/*
+ * The robot state packages of the secondary interface other than robot
+ * mode and masterboard data (see RobotModeView and MasterboardView). Field
+ * names follow the client interface documentation of UR.
+ */
+
+struct joint_data {
+	double qActual[6];
+	double qTarget[6];
+	double qdActual[6];
+	float iActual[6];
+	float vActual[6];
+	float tMotor[6];
+	float tMicro[6]; //deprecated by UR, always 0 on newer firmware
+	uint8_t jointMode[6];
+};
+
+struct tool_data {
+	int8_t analogInputRange2;
+	int8_t analogInputRange3;
+	double analogInput2;
+	double analogInput3;
+	float toolVoltage48V;
+	uint8_t toolOutputVoltage;
+	float toolCurrent;
+	float toolTemperature;
+	uint8_t toolMode;
+};
+
+struct cartesian_info {
+	double pose[6]; //X, Y, Z, Rx, Ry, Rz of the TCP
+	double tcpOffset[6]; //from version 3.1, 0 before
+};
+
+struct kinematics_info {
+	uint32_t checksum[6];
+	double dhTheta[6];
+	double dhA[6];
+	double dhD[6];
+	double dhAlpha[6];
+	uint32_t calibrationStatus;
+};
+
+struct configuration_data {
+	double jointMinLimit[6];
+	double jointMaxLimit[6];
+	double jointMaxSpeed[6];
+	double jointMaxAcceleration[6];
+	double vJointDefault;
+	double aJointDefault;
+	double vToolDefault;
+	double aToolDefault;
+	double eqRadius;
+	double dhA[6];
+	double dhD[6];
+	double dhAlpha[6];
+	double dhTheta[6];
+	int32_t masterboardVersion;
+	int32_t controllerBoxType;
+	int32_t robotType;
+	int32_t robotSubType;
+};
+
+struct force_mode_data {
+	double frame[6]; //X, Y, Z, Rx, Ry, Rz
+	double robotDexterity;
+};
+
+struct additional_info {
+	uint8_t freedriveButtonPressed;
+	uint8_t freedriveButtonEnabled;
+	uint8_t ioEnabledFreedrive; //from version 3.2, 0 before
+};
+
+struct calibration_data {
+	double force[6]; //Fx, Fy, Fz, Frx, Fry, Frz
+};
+
+struct secondary_state_data {
+	uint64_t sequence; //Robot state messages decoded before this one
+	uint32_t received; //Bit 1 << package type for every package decoded so far
+	joint_data joints;
+	tool_data tool;
+	cartesian_info cartesian;
+	kinematics_info kinematics;
+	configuration_data configuration;
+	force_mode_data forceMode;
+	additional_info additional;
+	calibration_data calibration;
+};
+
+/*
+ * Decodes the body of one robot state package (after the 5 byte header)
+ * into data. Returns false if the body is too short for the package type;
+ * data is left as it was then. Types without a decoder here return true.
+ */
+bool decodeSecondaryPackage(uint8_t package_type, const uint8_t * buf,
+		uint32_t len, secondary_state_data& data);
+
+/*
+ * Whether a package body of len bytes is long enough for
+ * decodeSecondaryPackage(), so it can be checked on receive and decoded
+ * later. True for types without a decoder here.
+ */
+bool secondaryPackageComplete(uint8_t package_type, uint32_t len);
+
+#endif /* UR_SECONDARY_STATE_H_ */
@@ -0,0 +1,74 @@
+/*
+ * seqlock.h
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UR_SEQLOCK_H_
+#define UR_SEQLOCK_H_
+
+#include <atomic>
+#include <string.h>
+#include <type_traits>
+
+/*
+ * Single writer / multiple reader sequence lock.
+ *
+ * The writer never blocks: it bumps the sequence counter to an odd value,
+ * copies the new value in and bumps the counter again. Readers copy the
+ * value out and retry if the counter was odd or changed meanwhile, so they
+ * always return one complete value written by a single store().
+ */
+template<typename T>
+class SeqLock {
+	static_assert(std::is_trivial<T>::value,
+			"SeqLock can only hold trivially copyable types");
+private:
+	std::atomic<unsigned int> seq_;
+	T value_;
+
+public:
+	SeqLock() :
+			seq_(0) {
+		memset(&value_, 0, sizeof(value_));
+	}
+
+	/* Must only be called from one thread */
+	void store(const T& inp) {
+		unsigned int seq = seq_.load(std::memory_order_relaxed);
+		seq_.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(&value_, &inp, sizeof(value_));
+		seq_.store(seq + 2, std::memory_order_release);
+	}
+
+	void load(T& ret) const {
+		unsigned int seq0, seq1;
+		do {
+			seq0 = seq_.load(std::memory_order_acquire);
+			memcpy(&ret, &value_, sizeof(ret));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			seq1 = seq_.load(std::memory_order_relaxed);
+		} while ((seq0 & 1) || seq0 != seq1);
+	}
+
+	T load() const {
+		T ret;
+		load(ret);
+		return ret;
+	}
+};
+
+#endif /* UR_SEQLOCK_H_ */
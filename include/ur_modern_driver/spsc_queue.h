@@ -0,0 +1,147 @@
+/*
+ * spsc_queue.h
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UR_SPSC_QUEUE_H_
+#define UR_SPSC_QUEUE_H_
+
+#include <atomic>
+#include <inttypes.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <type_traits>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+ * Lets consumers sleep until a producer has pushed something, without a
+ * mutex on the producer side. Consumers call prepare(), check their
+ * queues and then wait() with the value prepare() returned, so a push
+ * between the check and the wait is never missed. notify() only makes a
+ * system call when somebody is waiting.
+ */
+class WakeSignal {
+private:
+	std::atomic<int> seq_;
+	std::atomic<int> waiters_;
+
+public:
+	WakeSignal() :
+			seq_(0), waiters_(0) {
+	}
+
+	int prepare() {
+		return seq_.load();
+	}
+
+	/* Returns after a notify() since prepare(), a timeout or a signal */
+	void wait(int seq, long timeout_ns) {
+		struct timespec timeout;
+		timeout.tv_sec = timeout_ns / 1000000000L;
+		timeout.tv_nsec = timeout_ns % 1000000000L;
+		waiters_.fetch_add(1);
+		syscall(SYS_futex, reinterpret_cast<int*>(&seq_), FUTEX_WAIT_PRIVATE,
+				seq, &timeout, NULL, 0);
+		waiters_.fetch_sub(1);
+	}
+
+	void notify() {
+		seq_.fetch_add(1);
+		if (waiters_.load() > 0)
+			syscall(SYS_futex, reinterpret_cast<int*>(&seq_),
+					FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+	}
+};
+
+/*
+ * Bounded lock-free queue for one producer and one consumer thread.
+ *
+ * push() never blocks: when the consumer has fallen N entries behind, the
+ * new entry is dropped and counted as an overrun, so a slow consumer never
+ * delays the producer. The consumer sees the drop as a gap in whatever
+ * sequence number T carries.
+ */
+template<typename T, unsigned int N>
+class SpscQueue {
+	static_assert(std::is_trivial<T>::value,
+			"SpscQueue can only hold trivially copyable types");
+	static_assert(N > 0 && (N & (N - 1)) == 0,
+			"The capacity of SpscQueue must be a power of two");
+private:
+	// Producer and consumer indices on their own cache lines
+	std::atomic<uint64_t> head_; //next slot to write, only written by the producer
+	char pad0_[64 - sizeof(std::atomic<uint64_t>)];
+	std::atomic<uint64_t> tail_; //next slot to read, only written by the consumer
+	char pad1_[64 - sizeof(std::atomic<uint64_t>)];
+	std::atomic<unsigned long> pushed_;
+	std::atomic<unsigned long> overruns_;
+	WakeSignal* signal_;
+	T slots_[N];
+
+public:
+	SpscQueue() :
+			head_(0), tail_(0), pushed_(0), overruns_(0), signal_(NULL) {
+		memset(slots_, 0, sizeof(slots_));
+	}
+
+	/* Notified on every push. Set before the producer starts */
+	void setSignal(WakeSignal* signal) {
+		signal_ = signal;
+	}
+
+	/* Producer only. Returns false if the entry was dropped */
+	bool push(const T& inp) {
+		uint64_t head = head_.load(std::memory_order_relaxed);
+		if (head - tail_.load(std::memory_order_acquire) >= N) {
+			overruns_.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		memcpy(&slots_[head & (N - 1)], &inp, sizeof(T));
+		head_.store(head + 1, std::memory_order_release);
+		pushed_.fetch_add(1, std::memory_order_relaxed);
+		if (signal_ != NULL)
+			signal_->notify();
+		return true;
+	}
+
+	/* Consumer only. Returns false if the queue is empty */
+	bool pop(T& ret) {
+		uint64_t tail = tail_.load(std::memory_order_relaxed);
+		if (tail == head_.load(std::memory_order_acquire))
+			return false;
+		memcpy(&ret, &slots_[tail & (N - 1)], sizeof(T));
+		tail_.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() {
+		return tail_.load(std::memory_order_acquire)
+				== head_.load(std::memory_order_acquire);
+	}
+
+	unsigned long getPushed() {
+		return pushed_.load(std::memory_order_relaxed);
+	}
+
+	unsigned long getOverruns() {
+		return overruns_.load(std::memory_order_relaxed);
+	}
+};
+
+#endif /* UR_SPSC_QUEUE_H_ */
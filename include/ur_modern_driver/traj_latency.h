@@ -0,0 +1,89 @@
+/*
+ * traj_latency.h
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UR_TRAJ_LATENCY_H_
+#define UR_TRAJ_LATENCY_H_
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <time.h>
+
+/*
+ * Tracepoints on the way from a received goal to the first setpoint sent
+ * to the robot. Each phase is the time between two consecutive
+ * tracepoints, the last phase is the whole startup.
+ */
+enum traj_tracepoint {
+	TRACE_GOAL_RECEIVED = 0,
+	TRACE_GOAL_ACCEPTED, //validated, reordered and interpolated
+	TRACE_THREAD_STARTED, //trajectory thread is running
+	TRACE_PROGRAM_SENT, //driverProg() queued for the robot, or reused
+	TRACE_REVERSE_CONNECTED, //the robot has connected back
+	TRACE_FIRST_SETPOINT, //first frame written to the reverse socket
+	TRACE_POINTS
+};
+
+struct traj_latency_phase {
+	unsigned long count;
+	double min; //seconds
+	double max;
+	double sum;
+	std::vector<unsigned long> bins;
+};
+
+/*
+ * Monotonic timestamps of the tracepoints of the current goal and a
+ * histogram per phase over all goals. Bin 0 holds phases below 1 us,
+ * bin i those of [2^(i-1), 2^i) us and the last bin everything above.
+ */
+class TrajLatency {
+private:
+	std::mutex lock_;
+	bool active_; //begin() was called and finish() wasn't yet
+	struct timespec stamps_[TRACE_POINTS];
+	bool marked_[TRACE_POINTS];
+	std::vector<traj_latency_phase> phases_;
+	std::vector<double> last_;
+
+public:
+	static const int PHASES = TRACE_POINTS; //consecutive pairs and the total
+	static const int BINS = 24;
+
+	TrajLatency();
+
+	/* Starts tracing a new goal, marks TRACE_GOAL_RECEIVED */
+	void begin();
+	/* Ignored without a goal being traced, so the ros_control path costs nothing */
+	void mark(traj_tracepoint point);
+	/*
+	 * Adds the phases of the traced goal to the histograms. Returns false
+	 * if no goal was traced or it didn't reach every tracepoint.
+	 */
+	bool finish();
+
+	std::vector<traj_latency_phase> getPhases();
+	/* Phase durations of the last finished goal, in seconds */
+	std::vector<double> getLast();
+	std::string lastToString();
+	void reset();
+
+	static const char* phaseName(int phase);
+};
+
+#endif /* UR_TRAJ_LATENCY_H_ */
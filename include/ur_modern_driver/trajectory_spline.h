@@ -0,0 +1,86 @@
+/*
+ * trajectory_spline.h
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UR_TRAJECTORY_SPLINE_H_
+#define UR_TRAJECTORY_SPLINE_H_
+
+#include <vector>
+
+/*
+ * Piecewise polynomial joint trajectory, built once when a goal is
+ * accepted and sampled by the servo loop.
+ *
+ * The coefficients of segment s are stored as coefficient rows over all
+ * joints: coeffs_[(s * order_ + k) * joints_ + j] is the coefficient of
+ * (t - start of s)^k for joint j. A sample touches one contiguous block,
+ * evaluates it with Horner's scheme and allocates nothing.
+ */
+class TrajectorySpline {
+private:
+	unsigned int joints_;
+	unsigned int segments_;
+	unsigned int order_; //coefficients per segment and joint
+	std::vector<double> knots_; //segments_ + 1 start times
+	std::vector<double> coeffs_;
+	unsigned int cursor_; //segment of the last sample
+
+	unsigned int findSegment(double t, unsigned int& cursor);
+	bool init(const std::vector<double>& timestamps,
+			const std::vector<std::vector<double> >& positions,
+			unsigned int order);
+
+public:
+	TrajectorySpline();
+
+	/*
+	 * Cubic Hermite segments through the given positions and velocities.
+	 * Returns false if the vectors don't describe at least one segment.
+	 */
+	bool buildCubic(const std::vector<double>& timestamps,
+			const std::vector<std::vector<double> >& positions,
+			const std::vector<std::vector<double> >& velocities);
+
+	/*
+	 * Quintic segments that also match the accelerations at every point,
+	 * so the acceleration is continuous where cubic segments jump.
+	 */
+	bool buildQuintic(const std::vector<double>& timestamps,
+			const std::vector<std::vector<double> >& positions,
+			const std::vector<std::vector<double> >& velocities,
+			const std::vector<std::vector<double> >& accelerations);
+
+	/*
+	 * Positions of all joints t seconds after the first point, clamped to
+	 * the trajectory.
+	 * Consecutive samples with increasing t find their segment in O(1).
+	 */
+	void sample(double t, double* positions);
+	/*
+	 * Same with a cursor of the caller (start it at 0), for a second series
+	 * of increasing samples next to the first, e.g. a lookahead.
+	 */
+	void sample(double t, double* positions, unsigned int& cursor);
+	void resetCursor();
+
+	unsigned int getJoints() const;
+	unsigned int getSegments() const;
+	unsigned int getDegree() const;
+	double getDuration() const;
+};
+
+#endif /* UR_TRAJECTORY_SPLINE_H_ */
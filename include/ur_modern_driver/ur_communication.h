@@ -20,6 +20,9 @@
 #define UR_COMMUNICATION_H_
 
 #include "robot_state.h"
+#include "packet_framer.h"
+#include "packet_log.h"
+#include "ur_reactor.h"
 #include "do_output.h"
 #include <vector>
 #include <stdlib.h>
@@ -38,26 +41,36 @@
 #include <unistd.h>
 #include <chrono>
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/types.h>
 
 
-class UrCommunication {
+class UrCommunication: public UrReactorHandler {
 private:
 	int pri_sockfd_, sec_sockfd_;
 	struct sockaddr_in pri_serv_addr_, sec_serv_addr_;
 	struct hostent *server_;
 	bool keepalive_;
-	std::thread comThread_;
+	UrReactor* reactor_;
+	bool connecting_; //waiting for a non-blocking reconnect to finish
 	int flag_;
-	void run();
+	PacketFramer framer_; //Reassembles secondary messages split by TCP
+	PacketLogWriter* packet_log_; //NULL unless the received bytes are recorded
+	void openSecondarySocket();
+	void readPackets();
+	void disconnected();
+	void reconnect();
 
 public:
 	bool connected_;
 	RobotState* robot_state_;
 
-	UrCommunication(std::condition_variable& msg_cond, std::string host);
+	UrCommunication(std::condition_variable& msg_cond, std::string host,
+			UrReactor* reactor);
 	bool start();
 	void halt();
+	void onEvent(int fd, uint32_t events);
+	void setPacketLog(PacketLogWriter* log);
 
 };
 
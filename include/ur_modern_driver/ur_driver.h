@@ -23,6 +23,9 @@
 #include <condition_variable>
 #include "ur_realtime_communication.h"
 #include "ur_communication.h"
+#include "ur_reactor.h"
+#include "trajectory_spline.h"
+#include "traj_latency.h"
 #include "do_output.h"
 #include <vector>
 #include <math.h>
@@ -30,11 +33,22 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
 
 #include <chrono>
+#include <time.h>
+
+/* Wake-up latency of the servo streaming loop, in seconds */
+struct servo_timing_stats {
+	unsigned long cycles;
+	unsigned long overruns; //cycles that were skipped because the loop woke up too late
+	double min_latency;
+	double max_latency;
+	double mean_latency;
+};
 
 
-class UrDriver {
+class UrDriver: public UrReactorHandler {
 private:
 	double maximum_time_step_;
 	double minimum_payload_;
@@ -44,25 +58,62 @@ private:
 	const int MULT_JOINTSTATE_ = 1000000;
 	const int MULT_TIME_ = 1000000;
 	const unsigned int REVERSE_PORT_;
+	const double REVERSE_CONNECT_TIMEOUT_ = 10.;
 	int incoming_sockfd_;
 	int new_sockfd_;
 	bool reverse_connected_;
+	bool keep_reverse_connection_;
+	bool servo_idle_; //driverProg() of the stream mode is connected and waits for a trajectory
+	std::mutex reverse_lock_; //guards new_sockfd_, reverse_connected_, servo_idle_ and the acks
+	std::mutex write_lock_; //held while writing to new_sockfd_ and while closing it, taken before reverse_lock_
+	std::condition_variable reverse_cond_;
+	const int BUFFER_POINTS_ = 125; //setpoints the controller buffers in buffered mode
+	const int POINTS_PER_FRAME_ = 4; //socket_read_binary_integer reads at most 30 ints
+	const int SERVO_PROTOCOL_VERSION_ = 2;
+	const int SERVO_HEADER_INTS_ = 5; //version, sequence, time, points, keepalive
+	int servo_seq_;
+	const double ACK_TIMEOUT_ = 1.;
+	bool buffered_traj_;
+	uint8_t ack_buf_[4];
+	unsigned int ack_len_;
+	unsigned long acks_received_;
+	int last_ack_; //setpoints the controller has executed
+	void readAcks();
+	bool sendBufferFrame(int cmd, const std::vector<int>& setpoints, int n,
+			unsigned long& acks);
+	bool waitForAck(unsigned long acks);
+	bool doTrajBuffered(TrajectorySpline& spline);
+	std::string servojCall();
+	bool sendServoFrame(const double* points, int n, double t, int keepalive);
+	void closeReverseConnection();
+	bool writeReverse(int fd, const struct iovec* iov, int iovcnt,
+			std::unique_lock<std::mutex>& write_lock);
+	void parkServo(const std::vector<double>& positions);
+	UrReactor* reactor_;
+	bool own_reactor_;
 	double servoj_time_;
 	bool executing_traj_;
 	double firmware_version_;
 	double servoj_lookahead_time_;
 	double servoj_gain_;
+	servo_timing_stats servo_timing_;
+	std::mutex servo_timing_lock_;
+	FlightRecorder* recorder_; //NULL unless the servo setpoints are recorded
 public:
 	UrRealtimeCommunication* rt_interface_;
 	UrCommunication* sec_interface_;
+	TrajLatency traj_latency_;
 
 	UrDriver(std::condition_variable& rt_msg_cond,
 			std::condition_variable& msg_cond, std::string host,
 			unsigned int reverse_port = 50007, double servoj_time = 0.016, unsigned int safety_count_max =
 					12, double max_time_step = 0.08, double min_payload = 0.,
-			double max_payload = 1., double servoj_lookahead_time=0.03, double servoj_gain=300.);
+			double max_payload = 1., double servoj_lookahead_time=0.03, double servoj_gain=300.,
+			UrReactor* reactor = NULL);
+	~UrDriver();
 	bool start();
 	void halt();
+	void onEvent(int fd, uint32_t events);
 
 	void setSpeed(double q0, double q1, double q2, double q3, double q4,
 			double q5, double acc = 100.);
@@ -70,11 +121,14 @@ public:
 	bool doTraj(std::vector<double> inp_timestamps,
 			std::vector<std::vector<double> > inp_positions,
 			std::vector<std::vector<double> > inp_velocities);
-	void servoj(std::vector<double> positions, int keepalive = 1);
+	bool doTraj(TrajectorySpline& spline);
+	void servoj(const std::vector<double>& positions, int keepalive = 1);
 
 	void stopTraj();
+	servo_timing_stats getServoTimingStats();
 
 	bool uploadProg();
+	bool uploadBufferedProg();
 	bool openServo();
 	void closeServo(std::vector<double> positions);
 
@@ -95,6 +149,10 @@ public:
 	void setServojTime(double t);
 	void setServojLookahead(double t);
 	void setServojGain(double g);
+	void setBufferedTrajectory(bool buffered);
+	void setKeepReverseConnection(bool keep);
+	void setPacketLog(PacketLogWriter* log);
+	void setFlightRecorder(FlightRecorder* recorder);
 
 };
 
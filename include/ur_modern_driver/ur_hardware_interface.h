@@ -91,6 +91,9 @@ public:
 	/// \brief Read the state from the robot hardware.
 	virtual void read();
 
+	/// \brief Read the state from an already taken snapshot of the robot hardware.
+	void read(const robot_state_rt_data& state);
+
 	/// \brief write the command to the robot hardware.
 	virtual void write();
 
@@ -0,0 +1,88 @@
+/*
+ * ur_reactor.h
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UR_REACTOR_H_
+#define UR_REACTOR_H_
+
+#include "do_output.h"
+#include <inttypes.h>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <sys/epoll.h>
+
+class UrReactorHandler {
+public:
+	virtual ~UrReactorHandler() {
+	}
+	/* Called on the reactor thread with the epoll events of fd */
+	virtual void onEvent(int fd, uint32_t events) = 0;
+};
+
+/*
+ * One epoll thread serving every controller socket (RT, secondary and
+ * reverse) of one or more robots.
+ *
+ * Handlers and timers are called on the reactor thread with the handler
+ * lock held. remove() and cancelTimers() take the same lock, so once they
+ * return the handler won't be called again and may be destroyed.
+ */
+class UrReactor {
+private:
+	struct timer {
+		std::chrono::steady_clock::time_point deadline;
+		UrReactorHandler* owner;
+		std::function<void()> fn;
+	};
+
+	int epoll_fd_;
+	int wake_fd_;
+	std::atomic<bool> keepalive_;
+	std::thread thread_;
+	std::recursive_mutex handlers_lock_;
+	std::map<int, UrReactorHandler*> handlers_;
+	std::vector<timer> timers_;
+
+	void run();
+	void wake();
+	int runTimers();
+
+public:
+	UrReactor();
+	~UrReactor();
+	bool start();
+	void halt();
+	bool isRunning();
+	std::thread& getThread();
+
+	bool add(int fd, uint32_t events, UrReactorHandler* handler);
+	bool modify(int fd, uint32_t events);
+	/* False if fd isn't registered for handler (anymore), nothing is removed then */
+	bool remove(int fd, UrReactorHandler* handler);
+
+	/* Runs fn on the reactor thread after the given delay */
+	void callAfter(double seconds, UrReactorHandler* owner,
+			std::function<void()> fn);
+	void cancelTimers(UrReactorHandler* owner);
+};
+
+#endif /* UR_REACTOR_H_ */
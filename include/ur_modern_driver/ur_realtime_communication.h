@@ -20,6 +20,10 @@
 #define UR_REALTIME_COMMUNICATION_H_
 
 #include "robot_state_RT.h"
+#include "packet_framer.h"
+#include "packet_log.h"
+#include "flight_recorder.h"
+#include "ur_reactor.h"
 #include "do_output.h"
 #include <vector>
 #include <stdlib.h>
@@ -41,7 +45,7 @@
 #include <fcntl.h>
 #include <sys/types.h>
 
-class UrRealtimeCommunication {
+class UrRealtimeCommunication: public UrReactorHandler {
 private:
 	unsigned int safety_count_max_;
 	int sockfd_;
@@ -49,12 +53,19 @@ private:
 	struct hostent *server_;
 	std::string local_ip_;
 	bool keepalive_;
-	std::thread comThread_;
+	UrReactor* reactor_;
+	bool connecting_; //waiting for a non-blocking reconnect to finish
 	int flag_;
 	std::recursive_mutex command_string_lock_;
 	std::string command_;
 	unsigned int safety_count_;
-	void run();
+	PacketFramer framer_; //Reassembles RT packets split or merged by TCP
+	PacketLogWriter* packet_log_; //NULL unless the received bytes are recorded
+	FlightRecorder* recorder_; //NULL unless commands are recorded
+	void openSocket();
+	void readPackets();
+	void disconnected();
+	void reconnect();
 
 
 public:
@@ -62,14 +73,20 @@ public:
 	RobotStateRT* robot_state_;
 
 	UrRealtimeCommunication(std::condition_variable& msg_cond, std::string host,
-			unsigned int safety_count_max = 12);
+			UrReactor* reactor, unsigned int safety_count_max = 12);
 	bool start();
 	void halt();
+	void onEvent(int fd, uint32_t events);
 	void setSpeed(double q0, double q1, double q2, double q3, double q4,
 			double q5, double acc = 100.);
 	void addCommandToQueue(std::string inp);
 	void setSafetyCountMax(uint inp);
+	void setPacketLog(PacketLogWriter* log);
+	void setFlightRecorder(FlightRecorder* recorder);
 	std::string getLocalIp();
+	unsigned long getPartialReads();
+	unsigned long getCoalescedReads();
+	unsigned long getFramingErrors();
 
 };
 
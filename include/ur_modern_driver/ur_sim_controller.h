@@ -0,0 +1,130 @@
+/*
+ * ur_sim_controller.h
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UR_SIM_CONTROLLER_H_
+#define UR_SIM_CONTROLLER_H_
+
+#include "do_output.h"
+#include <inttypes.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+/*
+ * Stand-in for a UR controller on the local machine, so the driver can be
+ * run and benchmarked without an arm.
+ *
+ * - 30001 and 30002 send the version message on connect and robot mode
+ *   and masterboard data at 10 Hz.
+ * - 30003 sends RT packets in the layout of the given firmware version.
+ * - URScript is accepted on all three ports. driverProg() connects back to
+ *   the reverse port and runs the stream or the buffered protocol of
+ *   UrDriver. speedj, stopj and the outputs set by secondary programs are
+ *   handled too, anything else is ignored.
+ *
+ * The arm follows servoj setpoints exactly and speedj/stopj with the
+ * given acceleration. There are no joint limits, payload or safety.
+ */
+class UrSimController {
+private:
+	struct joint_state {
+		double q[6];
+		double qd[6];
+		double qdd[6];
+		bool speed_mode; //qd is ramped to speed_target by the RT loop
+		double speed_target[6];
+		double speed_acc;
+		double speed_until; //monotonic time at which speedj returns, < 0 for never
+	};
+
+	struct driver_prog {
+		std::string ip;
+		int port;
+		bool buffered;
+		double servoj_time;
+		double mult; //MULT_jointstate
+		int buffer_len;
+	};
+
+	std::string host_;
+	double version_;
+	int rt_rate_;
+	std::atomic<bool> keepalive_;
+	double start_time_;
+
+	std::mutex state_lock_; //guards state_ and the outputs
+	joint_state state_;
+	uint32_t digital_outputs_;
+	double analog_outputs_[2];
+
+	int listen_fds_[3]; //30001, 30002, 30003
+	std::mutex clients_lock_; //guards the client lists, held while sending
+	std::vector<int> mb_clients_; //30001 and 30002
+	std::vector<int> rt_clients_;
+	std::map<int, std::string> script_in_; //unparsed URScript per client
+	std::map<int, std::string> program_in_; //program being received per client
+
+	std::thread io_thread_;
+	std::thread rt_thread_;
+	std::thread mb_thread_;
+	std::mutex program_lock_; //serializes starting and stopping programs
+	std::thread program_thread_;
+	std::atomic<bool> program_running_;
+	std::atomic<bool> stop_program_;
+
+	void runIO();
+	void runRT();
+	void runMb();
+	void runDriverProg(driver_prog prog);
+
+	bool openListener(int port, int& fd);
+	void addClient(int listen_index, int fd);
+	void removeClient(int fd);
+	void sendTo(std::vector<int>& clients, const uint8_t* buf, int len);
+	void onScript(int fd, const char* buf, int len);
+	void onScriptLine(int fd, const std::string& line);
+	void startProgram(const std::string& program);
+	void runSecondaryProgram(const std::string& program);
+	void executeLine(const std::string& line);
+	void stopProgram();
+
+	void servo(const double* q, double dt);
+	void stopj(double acc);
+	void integrate(double dt);
+
+	uint8_t robotMode();
+	int buildVersionMessage(uint8_t* buf);
+	int buildStateMessage(uint8_t* buf);
+	int buildRTPacket(uint8_t* buf);
+
+public:
+	/* version is the firmware version to report, rt_rate 125 or 500 Hz */
+	UrSimController(std::string host = "127.0.0.1", double version = 3.2,
+			int rt_rate = 125);
+	~UrSimController();
+	bool start();
+	void halt();
+	void setJointPositions(const std::vector<double>& q);
+	std::vector<double> getJointPositions();
+	bool isProgramRunning();
+};
+
+#endif /* UR_SIM_CONTROLLER_H_ */
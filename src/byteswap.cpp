@@ -0,0 +1,78 @@
+/*
+ * byteswap.cpp
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ur_modern_driver/byteswap.h"
+#include <string.h>
+#include <endian.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void unpack_be_doubles(const uint8_t * src, double * dst, size_t count) {
+	size_t i = 0;
+#if defined(__AVX2__)
+	// Reverse the bytes of each 64 bit lane, 4 doubles at a time
+	const __m256i mask = _mm256_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1,
+			2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6,
+			7);
+	for (; i + 4 <= count; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (src + i * 8));
+		_mm256_storeu_si256((__m256i *) (dst + i), _mm256_shuffle_epi8(v, mask));
+	}
+#endif
+#if defined(__AVX2__) || defined(__SSSE3__)
+	const __m128i mask128 = _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2,
+			3, 4, 5, 6, 7);
+	for (; i + 2 <= count; i += 2) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + i * 8));
+		_mm_storeu_si128((__m128i *) (dst + i), _mm_shuffle_epi8(v, mask128));
+	}
+#elif defined(__SSE2__)
+	// No byte shuffle: swap the bytes of each 16 bit word, then reverse the words
+	for (; i + 2 <= count; i += 2) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + i * 8));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+		v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+		_mm_storeu_si128((__m128i *) (dst + i), v);
+	}
+#endif
+	for (; i < count; i++) {
+		uint64_t q;
+		memcpy(&q, &src[i * 8], sizeof(q));
+		q = be64toh(q);
+		memcpy(&dst[i], &q, sizeof(q));
+	}
+}
+
+const char* unpack_be_doubles_kernel() {
+#if defined(__AVX2__)
+	return "avx2";
+#elif defined(__SSSE3__)
+	return "ssse3";
+#elif defined(__SSE2__)
+	return "sse2";
+#else
+	return "scalar";
+#endif
+}
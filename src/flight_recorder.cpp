@@ -0,0 +1,264 @@
+/*
+ * flight_recorder.cpp
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ur_modern_driver/flight_recorder.h"
+#include "ur_modern_driver/do_output.h"
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/mman.h>
+
+static const char FLIGHT_RECORDER_MAGIC[8] = { 'U', 'R', 'F', 'L', 'T', 'R',
+		'E', 'C' };
+static const uint32_t FLIGHT_RECORDER_VERSION = 1;
+
+static_assert(sizeof(flight_recorder_header) == 64,
+		"The flight recorder header is part of the file format");
+static_assert(sizeof(flight_record) == 344,
+		"The flight record is part of the file format");
+
+static uint64_t monotonicNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void fillHeader(flight_recorder_header& header, uint32_t capacity,
+		uint64_t head) {
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, FLIGHT_RECORDER_MAGIC, sizeof(header.magic));
+	header.version = FLIGHT_RECORDER_VERSION;
+	header.record_size = sizeof(flight_record);
+	header.capacity = capacity;
+	header.head = head;
+}
+
+FlightRecorder::FlightRecorder() {
+	header_ = NULL;
+	ring_ = NULL;
+	map_len_ = 0;
+	capacity_ = 0;
+}
+
+FlightRecorder::~FlightRecorder() {
+	close();
+}
+
+bool FlightRecorder::open(const std::string& path, uint32_t capacity) {
+	void* map;
+	if (capacity == 0)
+		return false;
+	map_len_ = sizeof(flight_recorder_header)
+			+ (size_t) capacity * sizeof(flight_record);
+	// Not backed by the file, so there is no writeback to fault on
+	map = mmap(NULL, map_len_, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		print_error("Could not allocate the flight recorder");
+		return false;
+	}
+	// Fault the pages in now instead of on the receive thread
+	memset(map, 0, map_len_);
+	header_ = (flight_recorder_header*) map;
+	ring_ = (flight_record*) ((uint8_t*) map + sizeof(flight_recorder_header));
+	capacity_ = capacity;
+	path_ = path;
+	fillHeader(*header_, capacity, 0);
+	print_debug(
+			"Flight recorder: Keeping the last " + std::to_string(capacity)
+					+ " records, dumped to " + path + ".<time>.dump");
+	return true;
+}
+
+void FlightRecorder::close() {
+	if (header_ == NULL)
+		return;
+	munmap(header_, map_len_);
+	header_ = NULL;
+	ring_ = NULL;
+	capacity_ = 0;
+}
+
+bool FlightRecorder::isOpen() {
+	return header_ != NULL;
+}
+
+flight_record* FlightRecorder::claim(flight_record_type type,
+		uint64_t& index) {
+	flight_record* r;
+	index = __atomic_fetch_add(&header_->head, 1, __ATOMIC_RELAXED);
+	r = &ring_[index % capacity_];
+	// Readers drop the slot until commit() stamps it again
+	__atomic_store_n(&r->stamp, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	r->time_ns = monotonicNs();
+	r->type = type;
+	return r;
+}
+
+void FlightRecorder::commit(flight_record* r, uint64_t index) {
+	__atomic_store_n(&r->stamp, index + 1, __ATOMIC_RELEASE);
+}
+
+void FlightRecorder::recordRT(const robot_state_rt_data& data) {
+	uint64_t index;
+	if (header_ == NULL)
+		return;
+	flight_record* r = FlightRecorder::claim(FLIGHT_RECORD_RT, index);
+	r->count = (uint32_t) data.sequence;
+	r->time = data.time;
+	r->robot_mode = data.robot_mode;
+	r->safety_mode = data.safety_mode;
+	r->speed_scaling = data.speed_scaling;
+	memcpy(&r->values[0], data.q_target.data(), 6 * sizeof(double));
+	memcpy(&r->values[6], data.qd_target.data(), 6 * sizeof(double));
+	memcpy(&r->values[12], data.q_actual.data(), 6 * sizeof(double));
+	memcpy(&r->values[18], data.qd_actual.data(), 6 * sizeof(double));
+	memcpy(&r->values[24], data.i_actual.data(), 6 * sizeof(double));
+	memcpy(&r->values[30], data.tcp_force.data(), 6 * sizeof(double));
+	FlightRecorder::commit(r, index);
+}
+
+void FlightRecorder::recordServo(const double* points, int n, double t) {
+	uint64_t index;
+	if (header_ == NULL)
+		return;
+	if (n > 6)
+		n = 6;
+	flight_record* r = FlightRecorder::claim(FLIGHT_RECORD_SERVOJ, index);
+	r->count = n;
+	r->time = t;
+	r->robot_mode = 0.;
+	r->safety_mode = 0.;
+	r->speed_scaling = 0.;
+	memset(r->values, 0, sizeof(r->values));
+	memcpy(r->values, points, n * 6 * sizeof(double));
+	FlightRecorder::commit(r, index);
+}
+
+void FlightRecorder::recordSpeed(const double* qd, double acc) {
+	uint64_t index;
+	if (header_ == NULL)
+		return;
+	flight_record* r = FlightRecorder::claim(FLIGHT_RECORD_SPEEDJ, index);
+	r->count = 1;
+	r->time = acc;
+	r->robot_mode = 0.;
+	r->safety_mode = 0.;
+	r->speed_scaling = 0.;
+	memset(r->values, 0, sizeof(r->values));
+	memcpy(r->values, qd, 6 * sizeof(double));
+	FlightRecorder::commit(r, index);
+}
+
+long FlightRecorder::dump(const std::string& path) {
+	flight_recorder_header header;
+	flight_record r;
+	uint64_t head, first, stamp;
+	long written = 0;
+	FILE* f;
+	if (header_ == NULL)
+		return -1;
+	f = fopen(path.c_str(), "wb");
+	if (f == NULL) {
+		print_error("Could not open flight recorder dump " + path);
+		return -1;
+	}
+	// The header is rewritten at the end, when the number of records is known
+	fillHeader(header, 0, 0);
+	fwrite(&header, 1, sizeof(header), f);
+	head = __atomic_load_n(&header_->head, __ATOMIC_ACQUIRE);
+	first = head > capacity_ ? head - capacity_ : 0;
+	for (uint64_t i = first; i < head; i++) {
+		const flight_record* slot = &ring_[i % capacity_];
+		stamp = __atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE);
+		if (stamp != i + 1)
+			continue;
+		memcpy(&r, slot, sizeof(r));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		// Overwritten by a writer that lapped us while copying
+		if (__atomic_load_n(&slot->stamp, __ATOMIC_RELAXED) != stamp)
+			continue;
+		fwrite(&r, 1, sizeof(r), f);
+		written += 1;
+	}
+	fillHeader(header, written, written);
+	fseek(f, 0, SEEK_SET);
+	fwrite(&header, 1, sizeof(header), f);
+	if (fclose(f) != 0) {
+		print_error("Could not write flight recorder dump " + path);
+		return -1;
+	}
+	return written;
+}
+
+std::string FlightRecorder::dump() {
+	char stamp[32];
+	time_t now = time(NULL);
+	struct tm local;
+	long written;
+	localtime_r(&now, &local);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+	std::string path = path_ + "." + stamp + ".dump";
+	written = FlightRecorder::dump(path);
+	if (written < 0)
+		return "";
+	print_info(
+			"Flight recorder: Wrote the last " + std::to_string(written)
+					+ " records to " + path);
+	return path;
+}
+
+bool FlightRecorder::read(const std::string& path,
+		std::vector<flight_record>& records) {
+	flight_recorder_header header;
+	uint64_t head, first;
+	FILE* f = fopen(path.c_str(), "rb");
+	records.clear();
+	if (f == NULL) {
+		print_error("Could not open flight recorder file " + path);
+		return false;
+	}
+	if (fread(&header, 1, sizeof(header), f) != sizeof(header)
+			|| memcmp(header.magic, FLIGHT_RECORDER_MAGIC,
+					sizeof(header.magic)) != 0
+			|| header.version != FLIGHT_RECORDER_VERSION
+			|| header.record_size != sizeof(flight_record)) {
+		print_error(path + " is not a flight recorder file of this version");
+		fclose(f);
+		return false;
+	}
+	std::vector<flight_record> ring(header.capacity);
+	if (header.capacity > 0
+			&& fread(ring.data(), sizeof(flight_record), ring.size(), f)
+					!= ring.size()) {
+		print_error(path + " is truncated");
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+	head = header.head;
+	first = head > header.capacity ? head - header.capacity : 0;
+	for (uint64_t i = first; i < head; i++) {
+		const flight_record& r = ring[i % header.capacity];
+		// A dump is stamped with the slot indices of the ring it came from
+		if (r.stamp != 0)
+			records.push_back(r);
+	}
+	return true;
+}
@@ -0,0 +1,115 @@
+/*
+ * packet_framer.cpp
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ur_modern_driver/packet_framer.h"
+#include <string.h>
+#include <netinet/in.h>
+
+PacketFramer::PacketFramer(uint32_t max_packet_length) :
+		max_packet_length_(max_packet_length), packets_(0), partial_reads_(0), coalesced_reads_(
+				0), framing_errors_(0) {
+	// Room for one incomplete packet plus at least one full read
+	buf_.resize(2 * max_packet_length_);
+	reset();
+}
+
+void PacketFramer::reset() {
+	head_ = 0;
+	tail_ = 0;
+	packets_since_commit_ = 0;
+	read_accounted_ = true;
+	failed_ = false;
+}
+
+bool PacketFramer::failed() {
+	return failed_;
+}
+
+uint8_t* PacketFramer::writePtr() {
+	if (head_ > 0 && buf_.size() - tail_ < max_packet_length_) {
+		memmove(&buf_[0], &buf_[head_], tail_ - head_);
+		tail_ -= head_;
+		head_ = 0;
+	}
+	return &buf_[tail_];
+}
+
+size_t PacketFramer::writeSpace() {
+	return buf_.size() - tail_;
+}
+
+void PacketFramer::commit(size_t bytes_read) {
+	tail_ += bytes_read;
+	packets_since_commit_ = 0;
+	read_accounted_ = false;
+}
+
+void PacketFramer::accountRead() {
+	if (read_accounted_)
+		return;
+	read_accounted_ = true;
+	if (packets_since_commit_ > 1)
+		coalesced_reads_++;
+	if (tail_ > head_)
+		partial_reads_++;
+}
+
+bool PacketFramer::next(uint8_t*& packet, uint32_t& len) {
+	if (failed_)
+		return false;
+	if (tail_ - head_ < sizeof(len)) {
+		accountRead();
+		return false;
+	}
+	memcpy(&len, &buf_[head_], sizeof(len));
+	len = ntohl(len);
+	if (len < sizeof(len) || len > max_packet_length_) {
+		// Nothing to resynchronize on in the stream, see failed()
+		framing_errors_++;
+		failed_ = true;
+		head_ = 0;
+		tail_ = 0;
+		return false;
+	}
+	if (tail_ - head_ < len) {
+		accountRead();
+		return false;
+	}
+	packet = &buf_[head_];
+	head_ += len;
+	if (head_ == tail_) {
+		head_ = 0;
+		tail_ = 0;
+	}
+	packets_since_commit_++;
+	packets_++;
+	return true;
+}
+
+unsigned long PacketFramer::getPackets() {
+	return packets_;
+}
+unsigned long PacketFramer::getPartialReads() {
+	return partial_reads_;
+}
+unsigned long PacketFramer::getCoalescedReads() {
+	return coalesced_reads_;
+}
+unsigned long PacketFramer::getFramingErrors() {
+	return framing_errors_;
+}
@@ -0,0 +1,222 @@
+/*
+ * packet_log.cpp
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ur_modern_driver/packet_log.h"
+#include "ur_modern_driver/do_output.h"
+#include <string.h>
+#include <endian.h>
+#include <time.h>
+#include <chrono>
+
+static const char PACKET_LOG_MAGIC[8] = { 'U', 'R', 'P', 'K', 'T', 'L', 'O',
+		'G' };
+static const uint32_t PACKET_LOG_VERSION = 1;
+static const size_t RECORD_HEADER = 1 + 4 + 8;
+static const size_t PENDING_WAKE = 1 << 20; //wake the writer thread early
+static const size_t PENDING_MAX = 8 << 20; //size of each buffer, drop records beyond this
+
+static uint64_t monotonicNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+PacketLogWriter::PacketLogWriter() {
+	file_ = NULL;
+	running_ = false;
+	start_ns_ = 0;
+	records_ = 0;
+	dropped_ = 0;
+	bytes_ = 0;
+}
+
+PacketLogWriter::~PacketLogWriter() {
+	close();
+}
+
+bool PacketLogWriter::open(const std::string& path) {
+	uint32_t version = htole32(PACKET_LOG_VERSION);
+	PacketLogWriter::close();
+	std::lock_guard<std::mutex> lock(lock_);
+	file_ = fopen(path.c_str(), "wb");
+	if (file_ == NULL) {
+		print_error("Could not open packet log " + path);
+		return false;
+	}
+	setvbuf(file_, NULL, _IOFBF, 1 << 20);
+	fwrite(PACKET_LOG_MAGIC, 1, sizeof(PACKET_LOG_MAGIC), file_);
+	fwrite(&version, 1, sizeof(version), file_);
+	start_ns_ = monotonicNs();
+	records_ = 0;
+	dropped_ = 0;
+	bytes_ = 0;
+	// Never reallocated by write(), which holds lock_
+	pending_.clear();
+	pending_.reserve(PENDING_MAX);
+	batch_.clear();
+	batch_.reserve(PENDING_MAX);
+	running_ = true;
+	thread_ = std::thread(&PacketLogWriter::writerThread, this);
+	print_info("Logging the packets received from the robot to " + path);
+	return true;
+}
+
+void PacketLogWriter::close() {
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		if (file_ == NULL)
+			return;
+		running_ = false;
+	}
+	cond_.notify_one();
+	thread_.join();
+	fclose(file_);
+	file_ = NULL;
+	if (dropped_ > 0)
+		print_warning(
+				"Packet log: " + std::to_string(dropped_)
+						+ " records dropped, the disk didn't keep up");
+}
+
+void PacketLogWriter::writerThread() {
+	std::unique_lock<std::mutex> lock(lock_);
+	while (running_ || !pending_.empty()) {
+		if (running_ && pending_.size() < PENDING_WAKE)
+			cond_.wait_for(lock, std::chrono::milliseconds(100));
+		// Swapping keeps the capacity of both buffers
+		batch_.swap(pending_);
+		lock.unlock();
+		if (!batch_.empty())
+			fwrite(batch_.data(), 1, batch_.size(), file_);
+		batch_.clear();
+		lock.lock();
+	}
+	lock.unlock();
+	fflush(file_);
+}
+
+void PacketLogWriter::write(packet_log_channel channel, const uint8_t* data,
+		uint32_t len) {
+	uint8_t header[RECORD_HEADER];
+	uint64_t t = monotonicNs();
+	bool wake;
+	std::unique_lock<std::mutex> lock(lock_);
+	if (!running_)
+		return;
+	if (pending_.size() + sizeof(header) + len > PENDING_MAX) {
+		dropped_ += 1;
+		return;
+	}
+	uint32_t le_len = htole32(len);
+	uint64_t le_t = htole64(t - start_ns_);
+	header[0] = (uint8_t) channel;
+	memcpy(&header[1], &le_len, sizeof(le_len));
+	memcpy(&header[5], &le_t, sizeof(le_t));
+	pending_.insert(pending_.end(), header, header + sizeof(header));
+	pending_.insert(pending_.end(), data, data + len);
+	records_ += 1;
+	bytes_ += len;
+	wake = pending_.size() >= PENDING_WAKE;
+	lock.unlock();
+	if (wake)
+		cond_.notify_one();
+}
+
+unsigned long PacketLogWriter::getRecords() {
+	std::lock_guard<std::mutex> lock(lock_);
+	return records_;
+}
+
+unsigned long PacketLogWriter::getDropped() {
+	std::lock_guard<std::mutex> lock(lock_);
+	return dropped_;
+}
+
+uint64_t PacketLogWriter::getBytes() {
+	std::lock_guard<std::mutex> lock(lock_);
+	return bytes_;
+}
+
+PacketLogReader::PacketLogReader() {
+	file_ = NULL;
+	size_ = 0;
+}
+
+PacketLogReader::~PacketLogReader() {
+	close();
+}
+
+bool PacketLogReader::open(const std::string& path) {
+	char magic[sizeof(PACKET_LOG_MAGIC)];
+	uint32_t version;
+	file_ = fopen(path.c_str(), "rb");
+	if (file_ == NULL) {
+		print_error("Could not open packet log " + path);
+		return false;
+	}
+	if (fread(magic, 1, sizeof(magic), file_) != sizeof(magic)
+			|| memcmp(magic, PACKET_LOG_MAGIC, sizeof(magic)) != 0
+			|| fread(&version, 1, sizeof(version), file_) != sizeof(version)) {
+		print_error(path + " is not a packet log");
+		close();
+		return false;
+	}
+	if (le32toh(version) != PACKET_LOG_VERSION) {
+		print_error(
+				"Unsupported packet log version "
+						+ std::to_string(le32toh(version)));
+		close();
+		return false;
+	}
+	fseek(file_, 0, SEEK_END);
+	size_ = ftell(file_);
+	PacketLogReader::rewind();
+	return true;
+}
+
+void PacketLogReader::close() {
+	if (file_ == NULL)
+		return;
+	fclose(file_);
+	file_ = NULL;
+}
+
+bool PacketLogReader::next(packet_log_record& record) {
+	uint8_t header[RECORD_HEADER];
+	uint32_t len;
+	uint64_t t;
+	if (file_ == NULL
+			|| fread(header, 1, sizeof(header), file_) != sizeof(header))
+		return false;
+	memcpy(&len, &header[1], sizeof(len));
+	memcpy(&t, &header[5], sizeof(t));
+	record.channel = header[0];
+	record.time_ns = le64toh(t);
+	// A corrupt length could ask for up to 4 GB
+	len = le32toh(len);
+	if (len > (uint64_t) (size_ - ftell(file_)))
+		return false;
+	record.data.resize(len);
+	return fread(record.data.data(), 1, record.data.size(), file_)
+			== record.data.size();
+}
+
+void PacketLogReader::rewind() {
+	if (file_ != NULL)
+		fseek(file_, sizeof(PACKET_LOG_MAGIC) + sizeof(uint32_t), SEEK_SET);
+}
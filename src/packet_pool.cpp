@@ -0,0 +1,115 @@
+/*
+ * packet_pool.cpp
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ur_modern_driver/packet_pool.h"
+#include <string.h>
+
+PacketRef::PacketRef(pooled_buffer* buf) :
+		buf_(buf) {
+}
+
+PacketRef::PacketRef(const PacketRef& other) :
+		buf_(other.buf_) {
+	if (buf_ != NULL)
+		buf_->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+PacketRef& PacketRef::operator=(const PacketRef& other) {
+	PacketRef tmp(other);
+	PacketRef::swap(tmp);
+	return *this;
+}
+
+PacketRef::~PacketRef() {
+	PacketRef::reset();
+}
+
+void PacketRef::reset() {
+	// The last reference returns the buffer, everything written to it is visible by then
+	if (buf_ != NULL && buf_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		buf_->pool->release(buf_);
+	buf_ = NULL;
+}
+
+void PacketRef::swap(PacketRef& other) {
+	pooled_buffer* tmp = buf_;
+	buf_ = other.buf_;
+	other.buf_ = tmp;
+}
+
+PacketPool::PacketPool(uint32_t buffer_size, unsigned int count) :
+		buffer_size_(buffer_size) {
+	free_.reserve(count);
+	for (unsigned int i = 0; i < count; i++)
+		free_.push_back(PacketPool::allocate());
+}
+
+PacketPool::~PacketPool() {
+	for (unsigned int i = 0; i < all_.size(); i++) {
+		delete[] all_[i]->data;
+		delete all_[i];
+	}
+}
+
+pooled_buffer* PacketPool::allocate() {
+	pooled_buffer* buf = new pooled_buffer;
+	buf->refs = 0;
+	buf->pool = this;
+	buf->len = 0;
+	buf->data = new uint8_t[buffer_size_];
+	all_.push_back(buf);
+	// Room for every buffer, so release() never allocates
+	free_.reserve(all_.size());
+	return buf;
+}
+
+PacketRef PacketPool::copy(const uint8_t* packet, uint32_t len) {
+	pooled_buffer* buf;
+	if (len > buffer_size_)
+		return PacketRef();
+	lock_.lock();
+	if (free_.empty()) {
+		buf = PacketPool::allocate();
+	} else {
+		buf = free_.back();
+		free_.pop_back();
+	}
+	lock_.unlock();
+	memcpy(buf->data, packet, len);
+	buf->len = len;
+	buf->refs.store(1, std::memory_order_relaxed);
+	return PacketRef(buf);
+}
+
+void PacketPool::release(pooled_buffer* buf) {
+	lock_.lock();
+	free_.push_back(buf);
+	lock_.unlock();
+}
+
+unsigned int PacketPool::getBuffers() {
+	unsigned int buffers;
+	lock_.lock();
+	buffers = all_.size();
+	lock_.unlock();
+	return buffers;
+}
+
+uint32_t PacketPool::getBufferSize() {
+	return buffer_size_;
+}
@@ -18,20 +18,21 @@
 
 #include "ur_modern_driver/robot_state.h"
 
-RobotState::RobotState(std::condition_variable& msg_cond) {
+RobotState::RobotState(std::condition_variable& msg_cond) :
+		pool_(8192, 4) { //as long as the longest message UrCommunication frames
 	version_msg_.major_version = 0;
 	version_msg_.minor_version = 0;
 	new_data_available_ = false;
+	view_version_ = 0.;
+	sequence_ = 0;
+	decode_errors_ = 0;
 	pMsg_cond_ = &msg_cond;
 	RobotState::setDisconnected();
 	robot_mode_running_ = robotStateTypeV30::ROBOT_MODE_RUNNING;
 }
-double RobotState::ntohd(uint64_t nf) {
-	double x;
-	nf = be64toh(nf);
-	memcpy(&x, &nf, sizeof(x));
-	return x;
+RobotState::~RobotState() {
 }
+
 void RobotState::unpack(uint8_t* buf, unsigned int buf_length) {
 	/* Returns missing bytes to unpack a message, or 0 if all data was parsed */
 	unsigned int offset = 0;
@@ -90,31 +91,61 @@ void RobotState::unpackRobotMessage(uint8_t * buf, unsigned int offset,
 
 void RobotState::unpackRobotState(uint8_t * buf, unsigned int offset,
 		uint32_t len) {
-	offset += 5;
-	while (offset < len) {
+	/*
+	 * Only the package headers are read here. The message is copied once
+	 * into a pooled buffer, and every complete package replaces the view of
+	 * its type; fields are decoded when somebody asks for them.
+	 */
+	PacketRef packet = pool_.copy(&buf[offset], len);
+	PackageView packages[PACKAGE_TYPES];
+	double version = RobotState::getVersion();
+	unsigned int pos = 5;
+	if (packet.empty()) {
+		decode_errors_ += 1;
+		return;
+	}
+	// Only this thread replaces the views, so they can be read without the lock
+	for (unsigned int i = 0; i < PACKAGE_TYPES; i++)
+		packages[i] = packages_[i];
+	while (pos + 5 <= len) {
 		int32_t length;
 		uint8_t package_type;
-		memcpy(&length, &buf[offset], sizeof(length));
+		memcpy(&length, &buf[offset + pos], sizeof(length));
 		length = ntohl(length);
-		memcpy(&package_type, &buf[offset + sizeof(length)],
-				sizeof(package_type));
+		package_type = buf[offset + pos + sizeof(length)];
+		if (length < 5 || (uint32_t) length > len - pos) {
+			// Can't find the next package after a bad length
+			decode_errors_ += 1;
+			break;
+		}
+		const uint8_t * body = &buf[offset + pos + 5];
+		uint32_t body_len = length - 5;
+		bool complete;
 		switch (package_type) {
 		case packageType::ROBOT_MODE_DATA:
-			val_lock_.lock();
-			RobotState::unpackRobotMode(buf, offset + 5);
-			val_lock_.unlock();
+			complete = RobotModeView::complete(body_len, version);
 			break;
-
 		case packageType::MASTERBOARD_DATA:
-			val_lock_.lock();
-			RobotState::unpackRobotStateMasterboard(buf, offset + 5);
-			val_lock_.unlock();
+			complete = MasterboardView::complete(body, body_len, version);
 			break;
 		default:
+			complete = secondaryPackageComplete(package_type, body_len);
 			break;
 		}
-		offset += length;
+		if (!complete)
+			decode_errors_ += 1;
+		else if (package_type < PACKAGE_TYPES)
+			packages[package_type] = PackageView(packet, pos + 5, body_len);
+		pos += length;
 	}
+
+	view_lock_.lock();
+	for (unsigned int i = 0; i < PACKAGE_TYPES; i++)
+		packages_[i].swap(packages[i]);
+	view_version_ = version;
+	sequence_++;
+	view_lock_.unlock();
+	// The views replaced are released here, outside the lock
 	new_data_available_ = true;
 	pMsg_cond_->notify_all();
 
@@ -146,172 +177,6 @@ void RobotState::unpackRobotMessageVersion(uint8_t * buf, unsigned int offset,
 	}
 }
 
-void RobotState::unpackRobotMode(uint8_t * buf, unsigned int offset) {
-	memcpy(&robot_mode_.timestamp, &buf[offset], sizeof(robot_mode_.timestamp));
-	offset += sizeof(robot_mode_.timestamp);
-	uint8_t tmp;
-	memcpy(&tmp, &buf[offset], sizeof(tmp));
-	if (tmp > 0)
-		robot_mode_.isRobotConnected = true;
-	else
-		robot_mode_.isRobotConnected = false;
-	offset += sizeof(tmp);
-	memcpy(&tmp, &buf[offset], sizeof(tmp));
-	if (tmp > 0)
-		robot_mode_.isRealRobotEnabled = true;
-	else
-		robot_mode_.isRealRobotEnabled = false;
-	offset += sizeof(tmp);
-	memcpy(&tmp, &buf[offset], sizeof(tmp));
-	//printf("PowerOnRobot: %d\n", tmp);
-	if (tmp > 0)
-		robot_mode_.isPowerOnRobot = true;
-	else
-		robot_mode_.isPowerOnRobot = false;
-	offset += sizeof(tmp);
-	memcpy(&tmp, &buf[offset], sizeof(tmp));
-	if (tmp > 0)
-		robot_mode_.isEmergencyStopped = true;
-	else
-		robot_mode_.isEmergencyStopped = false;
-	offset += sizeof(tmp);
-	memcpy(&tmp, &buf[offset], sizeof(tmp));
-	if (tmp > 0)
-		robot_mode_.isProtectiveStopped = true;
-	else
-		robot_mode_.isProtectiveStopped = false;
-	offset += sizeof(tmp);
-	memcpy(&tmp, &buf[offset], sizeof(tmp));
-	if (tmp > 0)
-		robot_mode_.isProgramRunning = true;
-	else
-		robot_mode_.isProgramRunning = false;
-	offset += sizeof(tmp);
-	memcpy(&tmp, &buf[offset], sizeof(tmp));
-	if (tmp > 0)
-		robot_mode_.isProgramPaused = true;
-	else
-		robot_mode_.isProgramPaused = false;
-	offset += sizeof(tmp);
-	memcpy(&robot_mode_.robotMode, &buf[offset], sizeof(robot_mode_.robotMode));
-	offset += sizeof(robot_mode_.robotMode);
-	uint64_t temp;
-	if (RobotState::getVersion() > 2.) {
-		memcpy(&robot_mode_.controlMode, &buf[offset],
-				sizeof(robot_mode_.controlMode));
-		offset += sizeof(robot_mode_.controlMode);
-		memcpy(&temp, &buf[offset], sizeof(temp));
-		offset += sizeof(temp);
-		robot_mode_.targetSpeedFraction = RobotState::ntohd(temp);
-	}
-	memcpy(&temp, &buf[offset], sizeof(temp));
-	offset += sizeof(temp);
-	robot_mode_.speedScaling = RobotState::ntohd(temp);
-}
-
-void RobotState::unpackRobotStateMasterboard(uint8_t * buf,
-		unsigned int offset) {
-	if (RobotState::getVersion() < 3.0) {
-		int16_t digital_input_bits, digital_output_bits;
-		memcpy(&digital_input_bits, &buf[offset], sizeof(digital_input_bits));
-		offset += sizeof(digital_input_bits);
-		memcpy(&digital_output_bits, &buf[offset], sizeof(digital_output_bits));
-		offset += sizeof(digital_output_bits);
-		mb_data_.digitalInputBits = ntohs(digital_input_bits);
-		mb_data_.digitalOutputBits = ntohs(digital_output_bits);
-	} else {
-		memcpy(&mb_data_.digitalInputBits, &buf[offset],
-				sizeof(mb_data_.digitalInputBits));
-		offset += sizeof(mb_data_.digitalInputBits);
-		mb_data_.digitalInputBits = ntohl(mb_data_.digitalInputBits);
-		memcpy(&mb_data_.digitalOutputBits, &buf[offset],
-				sizeof(mb_data_.digitalOutputBits));
-		offset += sizeof(mb_data_.digitalOutputBits);
-		mb_data_.digitalOutputBits = ntohl(mb_data_.digitalOutputBits);
-	}
-
-	memcpy(&mb_data_.analogInputRange0, &buf[offset],
-			sizeof(mb_data_.analogInputRange0));
-	offset += sizeof(mb_data_.analogInputRange0);
-	memcpy(&mb_data_.analogInputRange1, &buf[offset],
-			sizeof(mb_data_.analogInputRange1));
-	offset += sizeof(mb_data_.analogInputRange1);
-	uint64_t temp;
-	memcpy(&temp, &buf[offset], sizeof(temp));
-	offset += sizeof(temp);
-	mb_data_.analogInput0 = RobotState::ntohd(temp);
-	memcpy(&temp, &buf[offset], sizeof(temp));
-	offset += sizeof(temp);
-	mb_data_.analogInput1 = RobotState::ntohd(temp);
-	memcpy(&mb_data_.analogOutputDomain0, &buf[offset],
-			sizeof(mb_data_.analogOutputDomain0));
-	offset += sizeof(mb_data_.analogOutputDomain0);
-	memcpy(&mb_data_.analogOutputDomain1, &buf[offset],
-			sizeof(mb_data_.analogOutputDomain1));
-	offset += sizeof(mb_data_.analogOutputDomain1);
-	memcpy(&temp, &buf[offset], sizeof(temp));
-	offset += sizeof(temp);
-	mb_data_.analogOutput0 = RobotState::ntohd(temp);
-	memcpy(&temp, &buf[offset], sizeof(temp));
-	offset += sizeof(temp);
-	mb_data_.analogOutput1 = RobotState::ntohd(temp);
-
-	memcpy(&mb_data_.masterBoardTemperature, &buf[offset],
-			sizeof(mb_data_.masterBoardTemperature));
-	offset += sizeof(mb_data_.masterBoardTemperature);
-	mb_data_.masterBoardTemperature = ntohl(mb_data_.masterBoardTemperature);
-	memcpy(&mb_data_.robotVoltage48V, &buf[offset],
-			sizeof(mb_data_.robotVoltage48V));
-	offset += sizeof(mb_data_.robotVoltage48V);
-	mb_data_.robotVoltage48V = ntohl(mb_data_.robotVoltage48V);
-	memcpy(&mb_data_.robotCurrent, &buf[offset], sizeof(mb_data_.robotCurrent));
-	offset += sizeof(mb_data_.robotCurrent);
-	mb_data_.robotCurrent = ntohl(mb_data_.robotCurrent);
-	memcpy(&mb_data_.masterIOCurrent, &buf[offset],
-			sizeof(mb_data_.masterIOCurrent));
-	offset += sizeof(mb_data_.masterIOCurrent);
-	mb_data_.masterIOCurrent = ntohl(mb_data_.masterIOCurrent);
-
-	memcpy(&mb_data_.safetyMode, &buf[offset], sizeof(mb_data_.safetyMode));
-	offset += sizeof(mb_data_.safetyMode);
-	memcpy(&mb_data_.masterOnOffState, &buf[offset],
-			sizeof(mb_data_.masterOnOffState));
-	offset += sizeof(mb_data_.masterOnOffState);
-
-	memcpy(&mb_data_.euromap67InterfaceInstalled, &buf[offset],
-			sizeof(mb_data_.euromap67InterfaceInstalled));
-	offset += sizeof(mb_data_.euromap67InterfaceInstalled);
-	if (mb_data_.euromap67InterfaceInstalled != 0) {
-		memcpy(&mb_data_.euromapInputBits, &buf[offset],
-				sizeof(mb_data_.euromapInputBits));
-		offset += sizeof(mb_data_.euromapInputBits);
-		mb_data_.euromapInputBits = ntohl(mb_data_.euromapInputBits);
-		memcpy(&mb_data_.euromapOutputBits, &buf[offset],
-				sizeof(mb_data_.euromapOutputBits));
-		offset += sizeof(mb_data_.euromapOutputBits);
-		mb_data_.euromapOutputBits = ntohl(mb_data_.euromapOutputBits);
-		if (RobotState::getVersion() < 3.0) {
-			int16_t euromap_voltage, euromap_current;
-			memcpy(&euromap_voltage, &buf[offset], sizeof(euromap_voltage));
-			offset += sizeof(euromap_voltage);
-			memcpy(&euromap_current, &buf[offset], sizeof(euromap_current));
-			offset += sizeof(euromap_current);
-			mb_data_.euromapVoltage = ntohs(euromap_voltage);
-			mb_data_.euromapCurrent = ntohs(euromap_current);
-		} else {
-			memcpy(&mb_data_.euromapVoltage, &buf[offset],
-					sizeof(mb_data_.euromapVoltage));
-			offset += sizeof(mb_data_.euromapVoltage);
-			mb_data_.euromapVoltage = ntohl(mb_data_.euromapVoltage);
-			memcpy(&mb_data_.euromapCurrent, &buf[offset],
-					sizeof(mb_data_.euromapCurrent));
-			offset += sizeof(mb_data_.euromapCurrent);
-			mb_data_.euromapCurrent = ntohl(mb_data_.euromapCurrent);
-		}
-
-	}
-}
-
 double RobotState::getVersion() {
 	double ver;
 	val_lock_.lock();
@@ -330,58 +195,145 @@ bool RobotState::getNewDataAvailable() {
 	return new_data_available_;
 }
 
+void RobotState::getIOState(io_state& io) {
+	// All from the same packet, unlike the single getters
+	MasterboardView mb = RobotState::getMasterboardView();
+	io.digital_inputs = mb.digitalInputBits();
+	io.digital_outputs = mb.digitalOutputBits();
+	io.analog_inputs[0] = mb.analogInput0();
+	io.analog_inputs[1] = mb.analogInput1();
+	io.analog_outputs[0] = mb.analogOutput0();
+	io.analog_outputs[1] = mb.analogOutput1();
+}
+
+RobotModeView RobotState::getRobotModeView() {
+	std::lock_guard<std::mutex> lock(view_lock_);
+	return RobotModeView(packages_[packageType::ROBOT_MODE_DATA],
+			view_version_);
+}
+
+MasterboardView RobotState::getMasterboardView() {
+	std::lock_guard<std::mutex> lock(view_lock_);
+	return MasterboardView(packages_[packageType::MASTERBOARD_DATA],
+			view_version_);
+}
+
+void RobotState::snapshot(secondary_state_data& ret) {
+	PackageView packages[PACKAGE_TYPES];
+	memset(&ret, 0, sizeof(ret));
+	view_lock_.lock();
+	for (unsigned int i = 0; i < PACKAGE_TYPES; i++)
+		packages[i] = packages_[i];
+	ret.sequence = sequence_ > 0 ? sequence_ - 1 : 0;
+	view_lock_.unlock();
+	// Checked on receive, so decoding can't fail here
+	for (unsigned int i = 0; i < PACKAGE_TYPES; i++) {
+		if (packages[i].valid())
+			decodeSecondaryPackage(i, packages[i].body(), packages[i].length(),
+					ret);
+	}
+}
+
+unsigned long RobotState::getDecodeErrors() {
+	return decode_errors_;
+}
+
 int RobotState::getDigitalInputBits() {
-	return mb_data_.digitalInputBits;
+	return RobotState::getMasterboardView().digitalInputBits();
 }
 int RobotState::getDigitalOutputBits() {
-	return mb_data_.digitalOutputBits;
+	return RobotState::getMasterboardView().digitalOutputBits();
+}
+char RobotState::getAnalogInputRange0() {
+	return RobotState::getMasterboardView().analogInputRange0();
+}
+char RobotState::getAnalogInputRange1() {
+	return RobotState::getMasterboardView().analogInputRange1();
 }
 double RobotState::getAnalogInput0() {
-	return mb_data_.analogInput0;
+	return RobotState::getMasterboardView().analogInput0();
 }
 double RobotState::getAnalogInput1() {
-	return mb_data_.analogInput1;
+	return RobotState::getMasterboardView().analogInput1();
+}
+char RobotState::getAnalogOutputDomain0() {
+	return RobotState::getMasterboardView().analogOutputDomain0();
+}
+char RobotState::getAnalogOutputDomain1() {
+	return RobotState::getMasterboardView().analogOutputDomain1();
 }
 double RobotState::getAnalogOutput0() {
-	return mb_data_.analogOutput0;
-
+	return RobotState::getMasterboardView().analogOutput0();
 }
 double RobotState::getAnalogOutput1() {
-	return mb_data_.analogOutput1;
+	return RobotState::getMasterboardView().analogOutput1();
+}
+float RobotState::getMasterBoardTemperature() {
+	return RobotState::getMasterboardView().masterBoardTemperature();
+}
+float RobotState::getRobotVoltage48V() {
+	return RobotState::getMasterboardView().robotVoltage48V();
+}
+float RobotState::getRobotCurrent() {
+	return RobotState::getMasterboardView().robotCurrent();
+}
+float RobotState::getMasterIOCurrent() {
+	return RobotState::getMasterboardView().masterIOCurrent();
+}
+unsigned char RobotState::getSafetyMode() {
+	return RobotState::getMasterboardView().safetyMode();
+}
+char RobotState::getEuromap67InterfaceInstalled() {
+	return RobotState::getMasterboardView().euromap67InterfaceInstalled();
+}
+int RobotState::getEuromapInputBits() {
+	return RobotState::getMasterboardView().euromapInputBits();
+}
+int RobotState::getEuromapOutputBits() {
+	return RobotState::getMasterboardView().euromapOutputBits();
+}
+float RobotState::getEuromapVoltage() {
+	return RobotState::getMasterboardView().euromapVoltage();
+}
+float RobotState::getEuromapCurrent() {
+	return RobotState::getMasterboardView().euromapCurrent();
 }
 bool RobotState::isRobotConnected() {
-	return robot_mode_.isRobotConnected;
+	return RobotState::getRobotModeView().isRobotConnected();
 }
 bool RobotState::isRealRobotEnabled() {
-	return robot_mode_.isRealRobotEnabled;
+	return RobotState::getRobotModeView().isRealRobotEnabled();
 }
 bool RobotState::isPowerOnRobot() {
-	return robot_mode_.isPowerOnRobot;
+	return RobotState::getRobotModeView().isPowerOnRobot();
 }
 bool RobotState::isEmergencyStopped() {
-	return robot_mode_.isEmergencyStopped;
+	return RobotState::getRobotModeView().isEmergencyStopped();
 }
 bool RobotState::isProtectiveStopped() {
-	return robot_mode_.isProtectiveStopped;
+	return RobotState::getRobotModeView().isProtectiveStopped();
 }
 bool RobotState::isProgramRunning() {
-	return robot_mode_.isProgramRunning;
+	return RobotState::getRobotModeView().isProgramRunning();
 }
 bool RobotState::isProgramPaused() {
-	return robot_mode_.isProgramPaused;
+	return RobotState::getRobotModeView().isProgramPaused();
 }
 unsigned char RobotState::getRobotMode() {
-	return robot_mode_.robotMode;
+	return RobotState::getRobotModeView().robotMode();
 }
 bool RobotState::isReady() {
-	if (robot_mode_.robotMode == robot_mode_running_) {
+	RobotModeView mode = RobotState::getRobotModeView();
+	if (mode.valid() && mode.robotMode() == robot_mode_running_) {
 		return true;
 	}
 	return false;
 }
 
 void RobotState::setDisconnected() {
-	robot_mode_.isRobotConnected = false;
-	robot_mode_.isRealRobotEnabled = false;
-	robot_mode_.isPowerOnRobot = false;
+	// Until the next robot mode package, connected, enabled and powered read false
+	PackageView none;
+	view_lock_.lock();
+	packages_[packageType::ROBOT_MODE_DATA].swap(none);
+	view_lock_.unlock();
 }
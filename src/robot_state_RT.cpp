@@ -17,37 +17,184 @@
  */
 
 #include "ur_modern_driver/robot_state_RT.h"
+#include "ur_modern_driver/do_output.h"
+#include "ur_modern_driver/flight_recorder.h"
+#include "ur_modern_driver/byteswap.h"
+
+namespace rt_packet_layouts {
+/*
+ * Byte offsets of the fields in an RT packet (including the 4 byte length
+ * prefix), or -1 if the firmware doesn't send the field. A new firmware
+ * layout only needs a struct here and a line in RT_LAYOUTS below.
+ */
+struct V16 {
+	static const int LENGTH = 756;
+	static const bool EXACT_LENGTH = true;
+	static const int TIME = 4;
+	static const int Q_TARGET = 12;
+	static const int QD_TARGET = 60;
+	static const int QDD_TARGET = 108;
+	static const int I_TARGET = 156;
+	static const int M_TARGET = 204;
+	static const int Q_ACTUAL = 252;
+	static const int QD_ACTUAL = 300;
+	static const int I_ACTUAL = 348;
+	static const int I_CONTROL = -1;
+	static const int TOOL_ACCELEROMETER_VALUES = -1;
+	static const int TCP_FORCE = 540;
+	static const int TOOL_VECTOR_ACTUAL = 588;
+	static const int TCP_SPEED_ACTUAL = 636;
+	static const int TOOL_VECTOR_TARGET = -1;
+	static const int TCP_SPEED_TARGET = -1;
+	static const int DIGITAL_INPUT_BITS = 684;
+	static const int MOTOR_TEMPERATURES = 692;
+	static const int CONTROLLER_TIMER = 740;
+	static const int ROBOT_MODE = -1;
+	static const int JOINT_MODES = -1;
+	static const int SAFETY_MODE = -1;
+	static const int SPEED_SCALING = -1;
+	static const int LINEAR_MOMENTUM_NORM = -1;
+	static const int V_MAIN = -1;
+	static const int V_ROBOT = -1;
+	static const int I_ROBOT = -1;
+	static const int V_ACTUAL = -1;
+	static const int DIGITAL_OUTPUTS = -1;
+	static const int PROGRAM_STATE = -1;
+	static const int ELBOW_POSITION = -1;
+	static const int ELBOW_VELOCITY = -1;
+};
+struct V17: V16 {
+	static const int LENGTH = 764;
+	static const int TOOL_ACCELEROMETER_VALUES = 396;
+	static const int ROBOT_MODE = 756;
+};
+struct V18: V17 {
+	static const int LENGTH = 812;
+	static const int JOINT_MODES = 764;
+};
+struct V30: V18 {
+	static const int LENGTH = 1044;
+	static const int I_CONTROL = 396;
+	static const int TOOL_VECTOR_ACTUAL = 444;
+	static const int TCP_SPEED_ACTUAL = 492;
+	static const int TCP_FORCE = 540;
+	static const int TOOL_VECTOR_TARGET = 588;
+	static const int TCP_SPEED_TARGET = 636;
+	static const int SAFETY_MODE = 812;
+	static const int TOOL_ACCELEROMETER_VALUES = 868;
+	static const int SPEED_SCALING = 940;
+	static const int LINEAR_MOMENTUM_NORM = 948;
+	static const int V_MAIN = 972;
+	static const int V_ROBOT = 980;
+	static const int I_ROBOT = 988;
+	static const int V_ACTUAL = 996;
+};
+struct V32: V30 {
+	static const int LENGTH = 1060;
+	static const int DIGITAL_OUTPUTS = 1044;
+	static const int PROGRAM_STATE = 1052;
+};
+struct V35: V32 {
+	// Later firmware appends fields, which are ignored
+	static const int LENGTH = 1108;
+	static const bool EXACT_LENGTH = false;
+	static const int ELBOW_POSITION = 1060;
+	static const int ELBOW_VELOCITY = 1084;
+};
+}
+
+namespace {
+/* Fields are read from the packet after it has been converted to host order as a whole */
+template<int OFFSET>
+struct RTField {
+	static_assert((OFFSET - 4) % sizeof(double) == 0,
+			"RT fields are 8 byte aligned after the length prefix");
+	static const int INDEX = (OFFSET - 4) / sizeof(double);
+	static void unpack(const double * words, double& dest) {
+		dest = words[INDEX];
+	}
+	static void unpack(const double * words, uint64_t& dest) {
+		memcpy(&dest, &words[INDEX], sizeof(dest));
+	}
+	template<std::size_t N>
+	static void unpack(const double * words, std::array<double, N>& dest) {
+		memcpy(dest.data(), &words[INDEX], sizeof(double) * N);
+	}
+};
+template<>
+struct RTField<-1> {
+	template<typename T>
+	static void unpack(const double *, T&) {
+	}
+};
+
+template<typename L>
+bool decodeRTPacket(uint8_t * buf, int len, robot_state_rt_data& data) {
+	static const std::size_t WORDS = (L::LENGTH - 4) / sizeof(double);
+	double buf_words[WORDS];
+	if (L::EXACT_LENGTH ? len != L::LENGTH : len < L::LENGTH)
+		return false;
+	unpack_be_doubles(buf + 4, buf_words, WORDS);
+	const double * words = buf_words;
+	RTField<L::TIME>::unpack(words, data.time);
+	RTField<L::Q_TARGET>::unpack(words, data.q_target);
+	RTField<L::QD_TARGET>::unpack(words, data.qd_target);
+	RTField<L::QDD_TARGET>::unpack(words, data.qdd_target);
+	RTField<L::I_TARGET>::unpack(words, data.i_target);
+	RTField<L::M_TARGET>::unpack(words, data.m_target);
+	RTField<L::Q_ACTUAL>::unpack(words, data.q_actual);
+	RTField<L::QD_ACTUAL>::unpack(words, data.qd_actual);
+	RTField<L::I_ACTUAL>::unpack(words, data.i_actual);
+	RTField<L::I_CONTROL>::unpack(words, data.i_control);
+	RTField<L::TOOL_ACCELEROMETER_VALUES>::unpack(words,
+			data.tool_accelerometer_values);
+	RTField<L::TCP_FORCE>::unpack(words, data.tcp_force);
+	RTField<L::TOOL_VECTOR_ACTUAL>::unpack(words, data.tool_vector_actual);
+	RTField<L::TCP_SPEED_ACTUAL>::unpack(words, data.tcp_speed_actual);
+	RTField<L::TOOL_VECTOR_TARGET>::unpack(words, data.tool_vector_target);
+	RTField<L::TCP_SPEED_TARGET>::unpack(words, data.tcp_speed_target);
+	RTField<L::DIGITAL_INPUT_BITS>::unpack(words, data.digital_input_bits);
+	RTField<L::MOTOR_TEMPERATURES>::unpack(words, data.motor_temperatures);
+	RTField<L::CONTROLLER_TIMER>::unpack(words, data.controller_timer);
+	RTField<L::ROBOT_MODE>::unpack(words, data.robot_mode);
+	RTField<L::JOINT_MODES>::unpack(words, data.joint_modes);
+	RTField<L::SAFETY_MODE>::unpack(words, data.safety_mode);
+	RTField<L::SPEED_SCALING>::unpack(words, data.speed_scaling);
+	RTField<L::LINEAR_MOMENTUM_NORM>::unpack(words, data.linear_momentum_norm);
+	RTField<L::V_MAIN>::unpack(words, data.v_main);
+	RTField<L::V_ROBOT>::unpack(words, data.v_robot);
+	RTField<L::I_ROBOT>::unpack(words, data.i_robot);
+	RTField<L::V_ACTUAL>::unpack(words, data.v_actual);
+	RTField<L::DIGITAL_OUTPUTS>::unpack(words, data.digital_outputs);
+	RTField<L::PROGRAM_STATE>::unpack(words, data.program_state);
+	RTField<L::ELBOW_POSITION>::unpack(words, data.elbow_position);
+	RTField<L::ELBOW_VELOCITY>::unpack(words, data.elbow_velocity);
+	return true;
+}
+
+struct rt_layout_entry {
+	double min_version; //inclusive
+	double max_version; //exclusive
+	const char* name;
+	rt_packet_decoder decoder;
+};
+
+const rt_layout_entry RT_LAYOUTS[] = {
+		{ 1.6, 1.7, "v1.6", &decodeRTPacket<rt_packet_layouts::V16> },
+		{ 1.7, 1.8, "v1.7", &decodeRTPacket<rt_packet_layouts::V17> },
+		{ 1.8, 3.0, "v1.8", &decodeRTPacket<rt_packet_layouts::V18> },
+		{ 3.0, 3.2, "v3.0/v3.1", &decodeRTPacket<rt_packet_layouts::V30> },
+		{ 3.2, 3.5, "v3.2-v3.4", &decodeRTPacket<rt_packet_layouts::V32> },
+		{ 3.5, 1000., "v3.5+", &decodeRTPacket<rt_packet_layouts::V35> } };
+}
 
 RobotStateRT::RobotStateRT(std::condition_variable& msg_cond) {
 	version_ = 0.0;
-	time_ = 0.0;
-	q_target_.assign(6, 0.0);
-	qd_target_.assign(6, 0.0);
-	qdd_target_.assign(6, 0.0);
-	i_target_.assign(6, 0.0);
-	m_target_.assign(6, 0.0);
-	q_actual_.assign(6, 0.0);
-	qd_actual_.assign(6, 0.0);
-	i_actual_.assign(6, 0.0);
-	i_control_.assign(6, 0.0);
-	tool_vector_actual_.assign(6, 0.0);
-	tcp_speed_actual_.assign(6, 0.0);
-	tcp_force_.assign(6, 0.0);
-	tool_vector_target_.assign(6, 0.0);
-	tcp_speed_target_.assign(6, 0.0);
-	digital_input_bits_.assign(64, false);
-	motor_temperatures_.assign(6, 0.0);
-	controller_timer_ = 0.0;
-	robot_mode_ = 0.0;
-	joint_modes_.assign(6, 0.0);
-	safety_mode_ = 0.0;
-	tool_accelerometer_values_.assign(3, 0.0);
-	speed_scaling_ = 0.0;
-	linear_momentum_norm_ = 0.0;
-	v_main_ = 0.0;
-	v_robot_ = 0.0;
-	i_robot_ = 0.0;
-	v_actual_.assign(6, 0.0);
+	sequence_ = 0;
+	decoder_ = &decodeRTPacket<rt_packet_layouts::V35>;
+	recorder_ = NULL;
+	memset(&data_, 0, sizeof(data_));
+	state_.store(data_);
 	data_published_ = false;
 	controller_updated_ = false;
 	pMsg_cond_ = &msg_cond;
@@ -74,364 +221,177 @@ bool RobotStateRT::getControllerUpdated() {
 	return controller_updated_;
 }
 
-double RobotStateRT::ntohd(uint64_t nf) {
-	double x;
-	nf = be64toh(nf);
-	memcpy(&x, &nf, sizeof(x));
-	return x;
-}
-
-std::vector<double> RobotStateRT::unpackVector(uint8_t * buf, int start_index,
-		int nr_of_vals) {
-	uint64_t q;
-	std::vector<double> ret;
-	for (int i = 0; i < nr_of_vals; i++) {
-		memcpy(&q, &buf[start_index + i * sizeof(q)], sizeof(q));
-		ret.push_back(ntohd(q));
-	}
-	return ret;
-}
-
-std::vector<bool> RobotStateRT::unpackDigitalInputBits(int64_t data) {
+std::vector<bool> RobotStateRT::unpackDigitalInputBits(uint64_t data) {
 	std::vector<bool> ret;
 	for (int i = 0; i < 64; i++) {
-		ret.push_back((data & (1 << i)) >> i);
+		ret.push_back((data >> i) & 1);
 	}
 	return ret;
 }
 
 void RobotStateRT::setVersion(double ver) {
-	val_lock_.lock();
 	version_ = ver;
-	val_lock_.unlock();
 }
 
 double RobotStateRT::getVersion() {
-	double ret;
-	val_lock_.lock();
-	ret = version_;
-	val_lock_.unlock();
-	return ret;
+	return version_;
+}
+
+bool RobotStateRT::selectLayout() {
+	/* Picks the packet decoder for the firmware version once, so unpack doesn't have to */
+	double version = version_;
+	for (unsigned int i = 0; i < sizeof(RT_LAYOUTS) / sizeof(RT_LAYOUTS[0]);
+			i++) {
+		if (version >= RT_LAYOUTS[i].min_version
+				&& version < RT_LAYOUTS[i].max_version) {
+			decoder_ = RT_LAYOUTS[i].decoder;
+			print_debug(
+					std::string("Realtime port: Using packet layout ")
+							+ RT_LAYOUTS[i].name);
+			return true;
+		}
+	}
+	decoder_ = &decodeRTPacket<rt_packet_layouts::V35>;
+	print_warning(
+			"Realtime port: No packet layout known for firmware version "
+					+ std::to_string(version) + ". Assuming v3.5+");
+	return false;
+}
+
+void RobotStateRT::setFlightRecorder(FlightRecorder* recorder) {
+	recorder_ = recorder;
+}
+
+void RobotStateRT::addConsumer(rt_snapshot_queue* queue) {
+	consumers_.push_back(queue);
+}
+
+robot_state_rt_data RobotStateRT::snapshot() {
+	return state_.load();
+}
+void RobotStateRT::snapshot(robot_state_rt_data& ret) {
+	state_.load(ret);
 }
 double RobotStateRT::getTime() {
-	double ret;
-	val_lock_.lock();
-	ret = time_;
-	val_lock_.unlock();
-	return ret;
+	return state_.load().time;
 }
 std::vector<double> RobotStateRT::getQTarget() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = q_target_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.q_target.begin(), state.q_target.end());
 }
 std::vector<double> RobotStateRT::getQdTarget() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = qd_target_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.qd_target.begin(), state.qd_target.end());
 }
 std::vector<double> RobotStateRT::getQddTarget() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = qdd_target_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.qdd_target.begin(), state.qdd_target.end());
 }
 std::vector<double> RobotStateRT::getITarget() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = i_target_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.i_target.begin(), state.i_target.end());
 }
 std::vector<double> RobotStateRT::getMTarget() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = m_target_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.m_target.begin(), state.m_target.end());
 }
 std::vector<double> RobotStateRT::getQActual() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = q_actual_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.q_actual.begin(), state.q_actual.end());
 }
 std::vector<double> RobotStateRT::getQdActual() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = qd_actual_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.qd_actual.begin(), state.qd_actual.end());
 }
 std::vector<double> RobotStateRT::getIActual() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = i_actual_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.i_actual.begin(), state.i_actual.end());
 }
 std::vector<double> RobotStateRT::getIControl() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = i_control_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.i_control.begin(), state.i_control.end());
 }
 std::vector<double> RobotStateRT::getToolVectorActual() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = tool_vector_actual_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.tool_vector_actual.begin(), state.tool_vector_actual.end());
 }
 std::vector<double> RobotStateRT::getTcpSpeedActual() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = tcp_speed_actual_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.tcp_speed_actual.begin(), state.tcp_speed_actual.end());
 }
 std::vector<double> RobotStateRT::getTcpForce() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = tcp_force_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.tcp_force.begin(), state.tcp_force.end());
 }
 std::vector<double> RobotStateRT::getToolVectorTarget() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = tool_vector_target_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.tool_vector_target.begin(), state.tool_vector_target.end());
 }
 std::vector<double> RobotStateRT::getTcpSpeedTarget() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = tcp_speed_target_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.tcp_speed_target.begin(), state.tcp_speed_target.end());
 }
 std::vector<bool> RobotStateRT::getDigitalInputBits() {
-	std::vector<bool> ret;
-	val_lock_.lock();
-	ret = digital_input_bits_;
-	val_lock_.unlock();
-	return ret;
+	return unpackDigitalInputBits(state_.load().digital_input_bits);
 }
 std::vector<double> RobotStateRT::getMotorTemperatures() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = motor_temperatures_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.motor_temperatures.begin(), state.motor_temperatures.end());
 }
 double RobotStateRT::getControllerTimer() {
-	double ret;
-	val_lock_.lock();
-	ret = controller_timer_;
-	val_lock_.unlock();
-	return ret;
+	return state_.load().controller_timer;
 }
 double RobotStateRT::getRobotMode() {
-	double ret;
-	val_lock_.lock();
-	ret = robot_mode_;
-	val_lock_.unlock();
-	return ret;
+	return state_.load().robot_mode;
 }
 std::vector<double> RobotStateRT::getJointModes() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = joint_modes_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.joint_modes.begin(), state.joint_modes.end());
 }
 double RobotStateRT::getSafety_mode() {
-	double ret;
-	val_lock_.lock();
-	ret = safety_mode_;
-	val_lock_.unlock();
-	return ret;
+	return state_.load().safety_mode;
 }
 std::vector<double> RobotStateRT::getToolAccelerometerValues() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = tool_accelerometer_values_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.tool_accelerometer_values.begin(), state.tool_accelerometer_values.end());
 }
 double RobotStateRT::getSpeedScaling() {
-	double ret;
-	val_lock_.lock();
-	ret = speed_scaling_;
-	val_lock_.unlock();
-	return ret;
+	return state_.load().speed_scaling;
 }
 double RobotStateRT::getLinearMomentumNorm() {
-	double ret;
-	val_lock_.lock();
-	ret = linear_momentum_norm_;
-	val_lock_.unlock();
-	return ret;
+	return state_.load().linear_momentum_norm;
 }
 double RobotStateRT::getVMain() {
-	double ret;
-	val_lock_.lock();
-	ret = v_main_;
-	val_lock_.unlock();
-	return ret;
+	return state_.load().v_main;
 }
 double RobotStateRT::getVRobot() {
-	double ret;
-	val_lock_.lock();
-	ret = v_robot_;
-	val_lock_.unlock();
-	return ret;
+	return state_.load().v_robot;
 }
 double RobotStateRT::getIRobot() {
-	double ret;
-	val_lock_.lock();
-	ret = i_robot_;
-	val_lock_.unlock();
-	return ret;
+	return state_.load().i_robot;
 }
 std::vector<double> RobotStateRT::getVActual() {
-	std::vector<double> ret;
-	val_lock_.lock();
-	ret = v_actual_;
-	val_lock_.unlock();
-	return ret;
+	robot_state_rt_data state = state_.load();
+	return std::vector<double>(state.v_actual.begin(), state.v_actual.end());
 }
 void RobotStateRT::unpack(uint8_t * buf) {
-	int64_t digital_input_bits;
-	uint64_t unpack_to;
-	uint16_t offset = 0;
-	val_lock_.lock();
 	int len;
-	memcpy(&len, &buf[offset], sizeof(len));
-
-	offset += sizeof(len);
+	memcpy(&len, &buf[0], sizeof(len));
 	len = ntohl(len);
 
-	//Check the correct message length is received
-	bool len_good = true;
-	if (version_ >= 1.6 && version_ < 1.7) { //v1.6
-		if (len != 756)
-			len_good = false;
-	} else if (version_ >= 1.7 && version_ < 1.8) { //v1.7
-		if (len != 764)
-			len_good = false;
-	} else if (version_ >= 1.8 && version_ < 1.9) { //v1.8
-		if (len != 812)
-			len_good = false;
-	} else if (version_ >= 3.0 && version_ < 3.2) { //v3.0 & v3.1
-		if (len != 1044)
-			len_good = false;
-	} else if (version_ >= 3.2 && version_ < 3.3) { //v3.2
-		if (len != 1060)
-			len_good = false;
-	}
-
-	if (!len_good) {
+	//Check the correct message length is received while decoding
+	if (!decoder_(buf, len, data_)) {
 		printf("Wrong length of message on RT interface: %i\n", len);
-		val_lock_.unlock();
 		return;
 	}
-
-	memcpy(&unpack_to, &buf[offset], sizeof(unpack_to));
-	time_ = RobotStateRT::ntohd(unpack_to);
-	offset += sizeof(double);
-	q_target_ = unpackVector(buf, offset, 6);
-	offset += sizeof(double) * 6;
-	qd_target_ = unpackVector(buf, offset, 6);
-	offset += sizeof(double) * 6;
-	qdd_target_ = unpackVector(buf, offset, 6);
-	offset += sizeof(double) * 6;
-	i_target_ = unpackVector(buf, offset, 6);
-	offset += sizeof(double) * 6;
-	m_target_ = unpackVector(buf, offset, 6);
-	offset += sizeof(double) * 6;
-	q_actual_ = unpackVector(buf, offset, 6);
-	offset += sizeof(double) * 6;
-	qd_actual_ = unpackVector(buf, offset, 6);
-	offset += sizeof(double) * 6;
-	i_actual_ = unpackVector(buf, offset, 6);
-	offset += sizeof(double) * 6;
-	if (version_ <= 1.9) {
-		if (version_ > 1.6)
-			tool_accelerometer_values_ = unpackVector(buf, offset, 3);
-		offset += sizeof(double) * (3 + 15);
-		tcp_force_ = unpackVector(buf, offset, 6);
-		offset += sizeof(double) * 6;
-		tool_vector_actual_ = unpackVector(buf, offset, 6);
-		offset += sizeof(double) * 6;
-		tcp_speed_actual_ = unpackVector(buf, offset, 6);
-	} else {
-		i_control_ = unpackVector(buf, offset, 6);
-		offset += sizeof(double) * 6;
-		tool_vector_actual_ = unpackVector(buf, offset, 6);
-		offset += sizeof(double) * 6;
-		tcp_speed_actual_ = unpackVector(buf, offset, 6);
-		offset += sizeof(double) * 6;
-		tcp_force_ = unpackVector(buf, offset, 6);
-		offset += sizeof(double) * 6;
-		tool_vector_target_ = unpackVector(buf, offset, 6);
-		offset += sizeof(double) * 6;
-		tcp_speed_target_ = unpackVector(buf, offset, 6);
-	}
-	offset += sizeof(double) * 6;
-
-	memcpy(&digital_input_bits, &buf[offset], sizeof(digital_input_bits));
-	digital_input_bits_ = unpackDigitalInputBits(be64toh(digital_input_bits));
-	offset += sizeof(double);
-	motor_temperatures_ = unpackVector(buf, offset, 6);
-	offset += sizeof(double) * 6;
-	memcpy(&unpack_to, &buf[offset], sizeof(unpack_to));
-	controller_timer_ = ntohd(unpack_to);
-	if (version_ > 1.6) {
-		offset += sizeof(double) * 2;
-		memcpy(&unpack_to, &buf[offset], sizeof(unpack_to));
-		robot_mode_ = ntohd(unpack_to);
-		if (version_ > 1.7) {
-			offset += sizeof(double);
-			joint_modes_ = unpackVector(buf, offset, 6);
-		}
-	}
-	if (version_ > 1.8) {
-		offset += sizeof(double) * 6;
-		memcpy(&unpack_to, &buf[offset], sizeof(unpack_to));
-		safety_mode_ = ntohd(unpack_to);
-		offset += sizeof(double);
-		tool_accelerometer_values_ = unpackVector(buf, offset, 3);
-		offset += sizeof(double) * 3;
-		memcpy(&unpack_to, &buf[offset], sizeof(unpack_to));
-		speed_scaling_ = ntohd(unpack_to);
-		offset += sizeof(double);
-		memcpy(&unpack_to, &buf[offset], sizeof(unpack_to));
-		linear_momentum_norm_ = ntohd(unpack_to);
-		offset += sizeof(double);
-		memcpy(&unpack_to, &buf[offset], sizeof(unpack_to));
-		v_main_ = ntohd(unpack_to);
-		offset += sizeof(double);
-		memcpy(&unpack_to, &buf[offset], sizeof(unpack_to));
-		v_robot_ = ntohd(unpack_to);
-		offset += sizeof(double);
-		memcpy(&unpack_to, &buf[offset], sizeof(unpack_to));
-		i_robot_ = ntohd(unpack_to);
-		offset += sizeof(double);
-		v_actual_ = unpackVector(buf, offset, 6);
-	}
-	val_lock_.unlock();
+	data_.sequence = sequence_++;
+	state_.store(data_);
+	if (recorder_ != NULL)
+		recorder_->recordRT(data_);
+	for (unsigned int i = 0; i < consumers_.size(); i++)
+		consumers_[i]->push(data_);
 	controller_updated_ = true;
 	data_published_ = true;
 	pMsg_cond_->notify_all();
 
 }
-
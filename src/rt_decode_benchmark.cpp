@@ -0,0 +1,112 @@
+/*
+ * rt_decode_benchmark.cpp
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Microbenchmark of the RT packet decode. Measures ns/packet for
+ *  - the per-value memcpy + be64toh decode into std::vectors the driver used to do,
+ *  - the batched unpack_be_doubles kernel on its own,
+ *  - the complete RobotStateRT::unpack.
+ *
+ * Usage: rt_decode_benchmark [iterations]
+ */
+
+#include "ur_modern_driver/robot_state_RT.h"
+#include "ur_modern_driver/byteswap.h"
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+#include <endian.h>
+
+static const int PACKET_LENGTH = 1060; // v3.2
+static const int PACKET_WORDS = (PACKET_LENGTH - 4) / 8;
+
+static volatile double sink;
+
+static double ns_per_packet(std::chrono::steady_clock::time_point t0,
+		unsigned long iterations) {
+	return std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(
+			std::chrono::steady_clock::now() - t0).count() / iterations;
+}
+
+static std::vector<double> unpack_vector_per_value(uint8_t * buf,
+		int start_index, int nr_of_vals) {
+	uint64_t q;
+	double x;
+	std::vector<double> ret;
+	for (int i = 0; i < nr_of_vals; i++) {
+		memcpy(&q, &buf[start_index + i * sizeof(q)], sizeof(q));
+		q = be64toh(q);
+		memcpy(&x, &q, sizeof(x));
+		ret.push_back(x);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	unsigned long iterations = 1000000;
+	if (argc > 1)
+		iterations = strtoul(argv[1], NULL, 10);
+
+	uint8_t buf[2048];
+	int len = htonl(PACKET_LENGTH);
+	memcpy(buf, &len, sizeof(len));
+	for (int i = 0; i < PACKET_WORDS; i++) {
+		double x = i * 0.125;
+		uint64_t q;
+		memcpy(&q, &x, sizeof(q));
+		q = htobe64(q);
+		memcpy(&buf[4 + i * 8], &q, sizeof(q));
+	}
+
+	printf("RT packet decode, %d byte packets, %lu iterations, kernel: %s\n",
+			PACKET_LENGTH, iterations, unpack_be_doubles_kernel());
+
+	// Before: one memcpy + be64toh per value, grouped into vectors of 6 like the old unpack
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	for (unsigned long n = 0; n < iterations; n++) {
+		double acc = 0.;
+		for (int i = 0; i + 6 <= PACKET_WORDS; i += 6) {
+			std::vector<double> v = unpack_vector_per_value(buf, 4 + i * 8, 6);
+			acc += v[0];
+		}
+		sink = acc;
+	}
+	printf("  per-value decode into vectors: %8.1f ns/packet\n",
+			ns_per_packet(t0, iterations));
+
+	double words[PACKET_WORDS];
+	t0 = std::chrono::steady_clock::now();
+	for (unsigned long n = 0; n < iterations; n++) {
+		unpack_be_doubles(buf + 4, words, PACKET_WORDS);
+		sink = words[n % PACKET_WORDS];
+	}
+	printf("  batched byte swap only:        %8.1f ns/packet\n",
+			ns_per_packet(t0, iterations));
+
+	std::condition_variable msg_cond;
+	RobotStateRT robot_state(msg_cond);
+	robot_state.setVersion(3.2);
+	robot_state.selectLayout();
+	t0 = std::chrono::steady_clock::now();
+	for (unsigned long n = 0; n < iterations; n++) {
+		robot_state.unpack(buf);
+	}
+	printf("  RobotStateRT::unpack:          %8.1f ns/packet\n",
+			ns_per_packet(t0, iterations));
+	return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * rt_thread.cpp
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ur_modern_driver/rt_thread.h"
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+bool setRealtimePriority(pthread_t thread, int priority, std::string name) {
+	if (priority <= 0)
+		return true;
+	int min = sched_get_priority_min(SCHED_FIFO);
+	int max = sched_get_priority_max(SCHED_FIFO);
+	if (priority < min || priority > max) {
+		print_warning(
+				"RT priority " + std::to_string(priority) + " for " + name
+						+ " is outside [" + std::to_string(min) + ", "
+						+ std::to_string(max) + "]. Not changing it");
+		return false;
+	}
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+	int err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+	if (err != 0) {
+		print_warning(
+				"Could not run " + name + " with SCHED_FIFO priority "
+						+ std::to_string(priority) + ": " + strerror(err)
+						+ ". Check the rtprio limit of the user. Running with normal priority");
+		return false;
+	}
+	print_debug(
+			name + " runs with SCHED_FIFO priority "
+					+ std::to_string(priority));
+	return true;
+}
+
+bool setCpuAffinity(pthread_t thread, const std::vector<int>& cpus,
+		std::string name) {
+	if (cpus.empty())
+		return true;
+	long n_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	std::string cpu_list;
+	for (unsigned int i = 0; i < cpus.size(); i++) {
+		if (cpus[i] < 0 || cpus[i] >= n_cpus || cpus[i] >= CPU_SETSIZE) {
+			print_warning(
+					"Ignoring CPU " + std::to_string(cpus[i]) + " for " + name
+							+ ", the machine has " + std::to_string(n_cpus)
+							+ " CPUs");
+			continue;
+		}
+		CPU_SET(cpus[i], &set);
+		cpu_list += " " + std::to_string(cpus[i]);
+	}
+	if (CPU_COUNT(&set) == 0)
+		return false;
+	int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+	if (err != 0) {
+		print_warning(
+				"Could not pin " + name + " to CPUs" + cpu_list + ": "
+						+ strerror(err));
+		return false;
+	}
+	print_debug(name + " pinned to CPUs" + cpu_list);
+	return true;
+}
+
+bool applyRealtimeConfig(pthread_t thread, const rt_thread_config& config,
+		std::string name) {
+	bool affinity_set = setCpuAffinity(thread, config.cpus, name);
+	return setRealtimePriority(thread, config.priority, name) && affinity_set;
+}
+
+bool lockMemory() {
+	// Page faults in the receive or control path cost more than the memory
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		print_warning(
+				std::string("Could not lock the memory of the driver: ")
+						+ strerror(errno)
+						+ ". Check the memlock limit of the user");
+		return false;
+	}
+	print_debug("Memory of the driver is locked");
+	return true;
+}
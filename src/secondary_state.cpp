@@ -0,0 +1,212 @@
+/*
+ * secondary_state.cpp
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ur_modern_driver/secondary_state.h"
+#include "ur_modern_driver/robot_state.h"
+#include "ur_modern_driver/package_reader.h"
+
+/*
+ * Each decoder reads into a local copy and only hands it out when the
+ * package was long enough, so a truncated package never leaves half
+ * decoded values behind. Trailing fields of newer firmware are read when
+ * the package has them.
+ */
+
+static bool decodeJointData(PackageReader& r, joint_data& out) {
+	joint_data d;
+	for (unsigned int i = 0; i < 6; i++) {
+		d.qActual[i] = r.f64();
+		d.qTarget[i] = r.f64();
+		d.qdActual[i] = r.f64();
+		d.iActual[i] = r.f32();
+		d.vActual[i] = r.f32();
+		d.tMotor[i] = r.f32();
+		d.tMicro[i] = r.f32();
+		d.jointMode[i] = r.u8();
+	}
+	if (!r.ok())
+		return false;
+	out = d;
+	return true;
+}
+
+static bool decodeToolData(PackageReader& r, tool_data& out) {
+	tool_data d;
+	d.analogInputRange2 = r.i8();
+	d.analogInputRange3 = r.i8();
+	d.analogInput2 = r.f64();
+	d.analogInput3 = r.f64();
+	d.toolVoltage48V = r.f32();
+	d.toolOutputVoltage = r.u8();
+	d.toolCurrent = r.f32();
+	d.toolTemperature = r.f32();
+	d.toolMode = r.u8();
+	if (!r.ok())
+		return false;
+	out = d;
+	return true;
+}
+
+static bool decodeCartesianInfo(PackageReader& r, cartesian_info& out) {
+	cartesian_info d;
+	r.f64s(d.pose, 6);
+	if (r.remaining() >= sizeof(d.tcpOffset))
+		r.f64s(d.tcpOffset, 6);
+	else
+		memset(d.tcpOffset, 0, sizeof(d.tcpOffset));
+	if (!r.ok())
+		return false;
+	out = d;
+	return true;
+}
+
+static bool decodeKinematicsInfo(PackageReader& r, kinematics_info& out) {
+	kinematics_info d;
+	for (unsigned int i = 0; i < 6; i++)
+		d.checksum[i] = r.u32();
+	r.f64s(d.dhTheta, 6);
+	r.f64s(d.dhA, 6);
+	r.f64s(d.dhD, 6);
+	r.f64s(d.dhAlpha, 6);
+	d.calibrationStatus = r.u32();
+	if (!r.ok())
+		return false;
+	out = d;
+	return true;
+}
+
+static bool decodeConfigurationData(PackageReader& r,
+		configuration_data& out) {
+	configuration_data d;
+	for (unsigned int i = 0; i < 6; i++) {
+		d.jointMinLimit[i] = r.f64();
+		d.jointMaxLimit[i] = r.f64();
+	}
+	for (unsigned int i = 0; i < 6; i++) {
+		d.jointMaxSpeed[i] = r.f64();
+		d.jointMaxAcceleration[i] = r.f64();
+	}
+	d.vJointDefault = r.f64();
+	d.aJointDefault = r.f64();
+	d.vToolDefault = r.f64();
+	d.aToolDefault = r.f64();
+	d.eqRadius = r.f64();
+	r.f64s(d.dhA, 6);
+	r.f64s(d.dhD, 6);
+	r.f64s(d.dhAlpha, 6);
+	r.f64s(d.dhTheta, 6);
+	d.masterboardVersion = r.i32();
+	d.controllerBoxType = r.i32();
+	d.robotType = r.i32();
+	d.robotSubType = r.i32();
+	if (!r.ok())
+		return false;
+	out = d;
+	return true;
+}
+
+static bool decodeForceModeData(PackageReader& r, force_mode_data& out) {
+	force_mode_data d;
+	r.f64s(d.frame, 6);
+	d.robotDexterity = r.f64();
+	if (!r.ok())
+		return false;
+	out = d;
+	return true;
+}
+
+static bool decodeAdditionalInfo(PackageReader& r, additional_info& out) {
+	additional_info d;
+	d.freedriveButtonPressed = r.u8();
+	d.freedriveButtonEnabled = r.u8();
+	d.ioEnabledFreedrive = r.remaining() > 0 ? r.u8() : 0;
+	if (!r.ok())
+		return false;
+	out = d;
+	return true;
+}
+
+static bool decodeCalibrationData(PackageReader& r, calibration_data& out) {
+	calibration_data d;
+	r.f64s(d.force, 6);
+	if (!r.ok())
+		return false;
+	out = d;
+	return true;
+}
+
+bool secondaryPackageComplete(uint8_t package_type, uint32_t len) {
+	// Shortest bodies the decoders above accept
+	switch (package_type) {
+	case packageType::JOINT_DATA:
+		return len >= 6 * 41;
+	case packageType::TOOL_DATA:
+		return len >= 32;
+	case packageType::CARTESIAN_INFO:
+		return len >= 48;
+	case packageType::KINEMATICS_INFO:
+		return len >= 220;
+	case packageType::CONFIGURATION_DATA:
+		return len >= 440;
+	case packageType::FORCE_MODE_DATA:
+		return len >= 56;
+	case packageType::ADDITIONAL_INFO:
+		return len >= 2;
+	case packageType::CALIBRATION_DATA:
+		return len >= 48;
+	default:
+		return true;
+	}
+}
+
+bool decodeSecondaryPackage(uint8_t package_type, const uint8_t * buf,
+		uint32_t len, secondary_state_data& data) {
+	PackageReader r(buf, len);
+	bool ok;
+	switch (package_type) {
+	case packageType::JOINT_DATA:
+		ok = decodeJointData(r, data.joints);
+		break;
+	case packageType::TOOL_DATA:
+		ok = decodeToolData(r, data.tool);
+		break;
+	case packageType::CARTESIAN_INFO:
+		ok = decodeCartesianInfo(r, data.cartesian);
+		break;
+	case packageType::KINEMATICS_INFO:
+		ok = decodeKinematicsInfo(r, data.kinematics);
+		break;
+	case packageType::CONFIGURATION_DATA:
+		ok = decodeConfigurationData(r, data.configuration);
+		break;
+	case packageType::FORCE_MODE_DATA:
+		ok = decodeForceModeData(r, data.forceMode);
+		break;
+	case packageType::ADDITIONAL_INFO:
+		ok = decodeAdditionalInfo(r, data.additional);
+		break;
+	case packageType::CALIBRATION_DATA:
+		ok = decodeCalibrationData(r, data.calibration);
+		break;
+	default:
+		return true;
+	}
+	if (ok)
+		data.received |= 1 << package_type;
+	return ok;
+}
@@ -0,0 +1,122 @@
+/*
+ * traj_latency.cpp
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ur_modern_driver/traj_latency.h"
+#include <stdio.h>
+
+static const char* PHASE_NAMES[TrajLatency::PHASES] = { "goal_validation",
+		"thread_start", "program_upload", "reverse_connect", "first_setpoint",
+		"total" };
+
+TrajLatency::TrajLatency() {
+	reset();
+}
+
+void TrajLatency::begin() {
+	std::lock_guard<std::mutex> lock(lock_);
+	for (int i = 0; i < TRACE_POINTS; i++)
+		marked_[i] = false;
+	clock_gettime(CLOCK_MONOTONIC, &stamps_[TRACE_GOAL_RECEIVED]);
+	marked_[TRACE_GOAL_RECEIVED] = true;
+	active_ = true;
+}
+
+void TrajLatency::mark(traj_tracepoint point) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	std::lock_guard<std::mutex> lock(lock_);
+	if (!active_ or marked_[point])
+		return;
+	stamps_[point] = now;
+	marked_[point] = true;
+}
+
+bool TrajLatency::finish() {
+	std::lock_guard<std::mutex> lock(lock_);
+	if (!active_)
+		return false;
+	active_ = false;
+	for (int i = 0; i < TRACE_POINTS; i++) {
+		if (!marked_[i])
+			return false;
+	}
+	for (int i = 0; i < PHASES; i++) {
+		const struct timespec& a =
+				stamps_[i < PHASES - 1 ? i + 1 : TRACE_FIRST_SETPOINT];
+		const struct timespec& b =
+				stamps_[i < PHASES - 1 ? i : TRACE_GOAL_RECEIVED];
+		double d = (a.tv_sec - b.tv_sec) + (a.tv_nsec - b.tv_nsec) / 1e9;
+		int bin = 0;
+		while (bin < BINS - 1 and d * 1e6 >= (double) (1UL << bin))
+			bin++;
+		traj_latency_phase& p = phases_[i];
+		if (p.count == 0 || d < p.min)
+			p.min = d;
+		if (p.count == 0 || d > p.max)
+			p.max = d;
+		p.sum += d;
+		p.count += 1;
+		p.bins[bin] += 1;
+		last_[i] = d;
+	}
+	return true;
+}
+
+std::vector<traj_latency_phase> TrajLatency::getPhases() {
+	std::lock_guard<std::mutex> lock(lock_);
+	return phases_;
+}
+
+std::vector<double> TrajLatency::getLast() {
+	std::lock_guard<std::mutex> lock(lock_);
+	return last_;
+}
+
+std::string TrajLatency::lastToString() {
+	std::lock_guard<std::mutex> lock(lock_);
+	std::string ret = "Trajectory start latency:";
+	char buf[64];
+	for (int i = 0; i < PHASES; i++) {
+		sprintf(buf, " %s %.1f us%s", PHASE_NAMES[i], last_[i] * 1e6,
+				i < PHASES - 1 ? "," : "");
+		ret += buf;
+	}
+	return ret;
+}
+
+void TrajLatency::reset() {
+	std::lock_guard<std::mutex> lock(lock_);
+	active_ = false;
+	for (int i = 0; i < TRACE_POINTS; i++)
+		marked_[i] = false;
+	phases_.assign(PHASES, traj_latency_phase());
+	for (int i = 0; i < PHASES; i++) {
+		phases_[i].count = 0;
+		phases_[i].min = 0.;
+		phases_[i].max = 0.;
+		phases_[i].sum = 0.;
+		phases_[i].bins.assign(BINS, 0);
+	}
+	last_.assign(PHASES, 0.);
+}
+
+const char* TrajLatency::phaseName(int phase) {
+	if (phase < 0 or phase >= PHASES)
+		return "";
+	return PHASE_NAMES[phase];
+}
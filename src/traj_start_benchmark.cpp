@@ -0,0 +1,98 @@
+/*
+ * traj_start_benchmark.cpp
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Benchmark of the time from a goal to the first setpoint on the reverse
+ * socket. Runs short trajectories that move wrist 3 back and forth by
+ * 0.05 rad, the way trajThread() does, and prints the tracepoint phases.
+ * Meant to run against a simulated controller, not a real arm.
+ *
+ * Usage: traj_start_benchmark [robot_ip] [trajectories] [keep_reverse_connection]
+ */
+
+#include "ur_modern_driver/ur_driver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <condition_variable>
+
+int main(int argc, char **argv) {
+	std::string host = "127.0.0.1";
+	unsigned long trajectories = 20;
+	bool keep = true;
+	if (argc > 1)
+		host = argv[1];
+	if (argc > 2)
+		trajectories = strtoul(argv[2], NULL, 10);
+	if (argc > 3)
+		keep = atoi(argv[3]) != 0;
+
+	std::condition_variable rt_msg_cond, msg_cond;
+	UrDriver robot(rt_msg_cond, msg_cond, host);
+	robot.setServojTime(0.008);
+	robot.setKeepReverseConnection(keep);
+	if (!robot.start())
+		return 1;
+	// Wait for the first RT packets
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+	for (unsigned long n = 0; n < trajectories; n++) {
+		robot_state_rt_data state = robot.rt_interface_->robot_state_->snapshot();
+		std::vector<double> start(state.q_actual.begin(), state.q_actual.end());
+		std::vector<double> end = start;
+		end[5] += (n % 2 == 0) ? 0.05 : -0.05;
+
+		robot.traj_latency_.begin();
+		TrajectorySpline spline;
+		std::vector<double> timestamps = { 0., 0.2 };
+		std::vector<std::vector<double> > positions = { start, end };
+		std::vector<std::vector<double> > velocities(2,
+				std::vector<double>(6, 0.));
+		if (!spline.buildCubic(timestamps, positions, velocities)) {
+			print_error("Could not interpolate the benchmark trajectory");
+			break;
+		}
+		robot.traj_latency_.mark(TRACE_GOAL_ACCEPTED);
+		std::thread traj([&robot, &spline] {
+			robot.traj_latency_.mark(TRACE_THREAD_STARTED);
+			robot.doTraj(spline);
+		});
+		traj.join();
+	}
+
+	std::vector<traj_latency_phase> phases = robot.traj_latency_.getPhases();
+	printf("Trajectory start latency, %lu trajectories, reverse connection %s\n",
+			phases[TrajLatency::PHASES - 1].count, keep ? "kept" : "reopened");
+	for (int i = 0; i < TrajLatency::PHASES; i++) {
+		const traj_latency_phase& p = phases[i];
+		printf("  %-16s min %10.1f us  mean %10.1f us  max %10.1f us\n",
+				TrajLatency::phaseName(i), p.min * 1e6,
+				p.count > 0 ? p.sum / p.count * 1e6 : 0., p.max * 1e6);
+	}
+	printf("  total histogram:");
+	for (int i = 0; i < TrajLatency::BINS; i++) {
+		if (phases[TrajLatency::PHASES - 1].bins[i] > 0)
+			printf(" %s%lu us: %lu", i < TrajLatency::BINS - 1 ? "<" : ">=",
+					1UL << (i < TrajLatency::BINS - 1 ? i : i - 1),
+					phases[TrajLatency::PHASES - 1].bins[i]);
+	}
+	printf("\n");
+
+	robot.halt();
+	return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * trajectory_spline.cpp
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ur_modern_driver/trajectory_spline.h"
+#include <algorithm>
+
+TrajectorySpline::TrajectorySpline() :
+		joints_(0), segments_(0), order_(0), cursor_(0) {
+}
+
+bool TrajectorySpline::init(const std::vector<double>& timestamps,
+		const std::vector<std::vector<double> >& positions,
+		unsigned int order) {
+	segments_ = 0;
+	if (timestamps.size() < 2 || positions.size() != timestamps.size())
+		return false;
+	joints_ = positions[0].size();
+	order_ = order;
+	knots_ = timestamps;
+	coeffs_.assign((timestamps.size() - 1) * order_ * joints_, 0.);
+	cursor_ = 0;
+	return true;
+}
+
+bool TrajectorySpline::buildCubic(const std::vector<double>& timestamps,
+		const std::vector<std::vector<double> >& positions,
+		const std::vector<std::vector<double> >& velocities) {
+	if (velocities.size() != timestamps.size()
+			|| !init(timestamps, positions, 4))
+		return false;
+
+	for (unsigned int s = 0; s < timestamps.size() - 1; s++) {
+		const std::vector<double>& p0 = positions[s];
+		const std::vector<double>& p1 = positions[s + 1];
+		const std::vector<double>& v0 = velocities[s];
+		const std::vector<double>& v1 = velocities[s + 1];
+		if (p0.size() != joints_ || p1.size() != joints_
+				|| v0.size() != joints_ || v1.size() != joints_)
+			return false;
+		double* c = &coeffs_[s * order_ * joints_];
+		double T = timestamps[s + 1] - timestamps[s];
+		if (T <= 0.) {
+			// Duplicate time stamp: never sampled inside, just hold the end
+			for (unsigned int j = 0; j < joints_; j++)
+				c[j] = p1[j];
+			continue;
+		}
+		double inv_T = 1. / T;
+		double inv_T2 = inv_T * inv_T;
+		double inv_T3 = inv_T2 * inv_T;
+		for (unsigned int j = 0; j < joints_; j++) {
+			c[j] = p0[j];
+			c[joints_ + j] = v0[j];
+			c[2 * joints_ + j] = (-3 * p0[j] + 3 * p1[j] - 2 * T * v0[j]
+					- T * v1[j]) * inv_T2;
+			c[3 * joints_ + j] = (2 * p0[j] - 2 * p1[j] + T * v0[j]
+					+ T * v1[j]) * inv_T3;
+		}
+	}
+	segments_ = timestamps.size() - 1;
+	return true;
+}
+
+bool TrajectorySpline::buildQuintic(const std::vector<double>& timestamps,
+		const std::vector<std::vector<double> >& positions,
+		const std::vector<std::vector<double> >& velocities,
+		const std::vector<std::vector<double> >& accelerations) {
+	if (velocities.size() != timestamps.size()
+			|| accelerations.size() != timestamps.size()
+			|| !init(timestamps, positions, 6))
+		return false;
+
+	for (unsigned int s = 0; s < timestamps.size() - 1; s++) {
+		const std::vector<double>& p0 = positions[s];
+		const std::vector<double>& p1 = positions[s + 1];
+		const std::vector<double>& v0 = velocities[s];
+		const std::vector<double>& v1 = velocities[s + 1];
+		const std::vector<double>& a0 = accelerations[s];
+		const std::vector<double>& a1 = accelerations[s + 1];
+		if (p0.size() != joints_ || p1.size() != joints_
+				|| v0.size() != joints_ || v1.size() != joints_
+				|| a0.size() != joints_ || a1.size() != joints_)
+			return false;
+		double* c = &coeffs_[s * order_ * joints_];
+		double T = timestamps[s + 1] - timestamps[s];
+		if (T <= 0.) {
+			// Duplicate time stamp: never sampled inside, just hold the end
+			for (unsigned int j = 0; j < joints_; j++)
+				c[j] = p1[j];
+			continue;
+		}
+		double T2 = T * T;
+		double inv_T = 1. / T;
+		double inv_T3 = inv_T * inv_T * inv_T;
+		double inv_T4 = inv_T3 * inv_T;
+		double inv_T5 = inv_T4 * inv_T;
+		for (unsigned int j = 0; j < joints_; j++) {
+			double dp = p1[j] - p0[j];
+			c[j] = p0[j];
+			c[joints_ + j] = v0[j];
+			c[2 * joints_ + j] = 0.5 * a0[j];
+			c[3 * joints_ + j] = (20 * dp - (8 * v1[j] + 12 * v0[j]) * T
+					- (3 * a0[j] - a1[j]) * T2) * 0.5 * inv_T3;
+			c[4 * joints_ + j] = (-30 * dp + (14 * v1[j] + 16 * v0[j]) * T
+					+ (3 * a0[j] - 2 * a1[j]) * T2) * 0.5 * inv_T4;
+			c[5 * joints_ + j] = (12 * dp - 6 * (v1[j] + v0[j]) * T
+					- (a0[j] - a1[j]) * T2) * 0.5 * inv_T5;
+		}
+	}
+	segments_ = timestamps.size() - 1;
+	return true;
+}
+
+unsigned int TrajectorySpline::findSegment(double t, unsigned int& cursor) {
+	// The servo loop moves forward one tick at a time: try the cursor and
+	// the segment after it before searching
+	if (cursor >= segments_)
+		cursor = 0;
+	if (t >= knots_[cursor] && t < knots_[cursor + 1])
+		return cursor;
+	if (cursor + 2 <= segments_ && t >= knots_[cursor + 1]
+			&& t < knots_[cursor + 2]) {
+		cursor += 1;
+		return cursor;
+	}
+	std::vector<double>::const_iterator it = std::upper_bound(
+			knots_.begin(), knots_.end(), t);
+	if (it == knots_.begin())
+		cursor = 0;
+	else
+		cursor = std::min((unsigned int) (it - knots_.begin()) - 1,
+				segments_ - 1);
+	return cursor;
+}
+
+void TrajectorySpline::sample(double t, double* positions) {
+	TrajectorySpline::sample(t, positions, cursor_);
+}
+
+void TrajectorySpline::sample(double t, double* positions,
+		unsigned int& cursor) {
+	if (segments_ == 0)
+		return;
+	t = std::max(knots_[0], std::min(knots_[0] + t, knots_[segments_]));
+	unsigned int s = findSegment(t, cursor);
+	const double* c = &coeffs_[s * order_ * joints_];
+	double dt = t - knots_[s];
+	for (unsigned int j = 0; j < joints_; j++) {
+		double p = c[(order_ - 1) * joints_ + j];
+		for (int k = order_ - 2; k >= 0; k--)
+			p = p * dt + c[k * joints_ + j];
+		positions[j] = p;
+	}
+}
+
+void TrajectorySpline::resetCursor() {
+	cursor_ = 0;
+}
+
+unsigned int TrajectorySpline::getJoints() const {
+	return joints_;
+}
+
+unsigned int TrajectorySpline::getSegments() const {
+	return segments_;
+}
+
+unsigned int TrajectorySpline::getDegree() const {
+	return order_ - 1;
+}
+
+double TrajectorySpline::getDuration() const {
+	if (segments_ == 0)
+		return 0.;
+	return knots_[segments_] - knots_[0];
+}
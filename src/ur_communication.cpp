@@ -19,18 +19,17 @@
 #include "ur_modern_driver/ur_communication.h"
 
 UrCommunication::UrCommunication(std::condition_variable& msg_cond,
-		std::string host) {
+		std::string host, UrReactor* reactor) :
+		framer_(8192) {
 	robot_state_ = new RobotState(msg_cond);
+	reactor_ = reactor;
+	packet_log_ = NULL;
 	bzero((char *) &pri_serv_addr_, sizeof(pri_serv_addr_));
 	bzero((char *) &sec_serv_addr_, sizeof(sec_serv_addr_));
 	pri_sockfd_ = socket(AF_INET, SOCK_STREAM, 0);
 	if (pri_sockfd_ < 0) {
 		print_fatal("ERROR opening socket pri_sockfd");
 	}
-	sec_sockfd_ = socket(AF_INET, SOCK_STREAM, 0);
-	if (sec_sockfd_ < 0) {
-		print_fatal("ERROR opening socket sec_sockfd");
-	}
 	server_ = gethostbyname(host.c_str());
 	if (server_ == NULL) {
 		print_fatal("ERROR, unknown host");
@@ -48,6 +47,18 @@ UrCommunication::UrCommunication(std::condition_variable& msg_cond,
 			sizeof(int));
 	setsockopt(pri_sockfd_, SOL_SOCKET, SO_REUSEADDR, (char *) &flag_,
 			sizeof(int));
+	openSecondarySocket();
+	connected_ = false;
+	connecting_ = false;
+	keepalive_ = false;
+}
+
+void UrCommunication::openSecondarySocket() {
+	sec_sockfd_ = socket(AF_INET, SOCK_STREAM, 0);
+	if (sec_sockfd_ < 0) {
+		print_fatal("ERROR opening socket sec_sockfd");
+	}
+	flag_ = 1;
 	setsockopt(sec_sockfd_, IPPROTO_TCP, TCP_NODELAY, (char *) &flag_,
 			sizeof(int));
 	setsockopt(sec_sockfd_, IPPROTO_TCP, TCP_QUICKACK, (char *) &flag_,
@@ -55,8 +66,6 @@ UrCommunication::UrCommunication(std::condition_variable& msg_cond,
 	setsockopt(sec_sockfd_, SOL_SOCKET, SO_REUSEADDR, (char *) &flag_,
 			sizeof(int));
 	fcntl(sec_sockfd_, F_SETFL, O_NONBLOCK);
-	connected_ = false;
-	keepalive_ = false;
 }
 
 bool UrCommunication::start() {
@@ -73,6 +82,8 @@ bool UrCommunication::start() {
 	}
 	print_debug("Acquire firmware version: Got connection");
 	bytes_read = read(pri_sockfd_, buf, 512);
+	if (packet_log_ != NULL && (int) bytes_read > 0)
+		packet_log_->write(PACKET_LOG_PRIMARY, buf, bytes_read);
 	setsockopt(pri_sockfd_, IPPROTO_TCP, TCP_QUICKACK, (char *) &flag_,
 			sizeof(int));
 	robot_state_->unpack(buf, bytes_read);
@@ -103,79 +114,128 @@ bool UrCommunication::start() {
 		return false;
 	}
 	print_debug("Secondary interface: Got connection");
-	comThread_ = std::thread(&UrCommunication::run, this);
+	connected_ = true;
+	if (!reactor_->add(sec_sockfd_, EPOLLIN | EPOLLRDHUP | EPOLLET, this)) {
+		connected_ = false;
+		close(sec_sockfd_);
+		sec_sockfd_ = -1;
+		return false;
+	}
 	return true;
 }
 
 void UrCommunication::halt() {
 	keepalive_ = false;
-	comThread_.join();
+	reactor_->cancelTimers(this);
+	// disconnected() may have closed the socket already, its fd reused since
+	if (sec_sockfd_ >= 0 && reactor_->remove(sec_sockfd_, this)) {
+		close(sec_sockfd_);
+		sec_sockfd_ = -1;
+		sec_sockfd_ = -1;
+	}
+	connected_ = false;
 }
 
-void UrCommunication::run() {
-	uint8_t buf[2048];
-	int bytes_read;
-	bzero(buf, 2048);
-	struct timeval timeout;
-	fd_set readfds;
-	FD_ZERO(&readfds);
-	FD_SET(sec_sockfd_, &readfds);
-	connected_ = true;
-	while (keepalive_) {
-		while (connected_ && keepalive_) {
-			timeout.tv_sec = 0; //do this each loop as selects modifies timeout
-			timeout.tv_usec = 500000; // timeout of 0.5 sec
-			select(sec_sockfd_ + 1, &readfds, NULL, NULL, &timeout);
-			bytes_read = read(sec_sockfd_, buf, 2048); // usually only up to 1295 bytes
-			if (bytes_read > 0) {
-				setsockopt(sec_sockfd_, IPPROTO_TCP, TCP_QUICKACK,
-						(char *) &flag_, sizeof(int));
-				robot_state_->unpack(buf, bytes_read);
-			} else {
-				connected_ = false;
-				robot_state_->setDisconnected();
-				close(sec_sockfd_);
-			}
+void UrCommunication::onEvent(int, uint32_t events) {
+	if (connecting_) {
+		if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+			return;
+		int err = 0;
+		socklen_t err_len = sizeof(err);
+		getsockopt(sec_sockfd_, SOL_SOCKET, SO_ERROR, &err, &err_len);
+		connecting_ = false;
+		if (err != 0) {
+			print_error("Error re-connecting to port 30002. Is controller started? Will try to reconnect in 10 seconds...");
+			reactor_->remove(sec_sockfd_, this);
+			close(sec_sockfd_);
+			sec_sockfd_ = -1;
+			reactor_->callAfter(10., this,
+					std::bind(&UrCommunication::reconnect, this));
+			return;
 		}
-		if (keepalive_) {
-			//reconnect
-			print_warning("Secondary port: No connection. Is controller crashed? Will try to reconnect in 10 seconds...");
-			sec_sockfd_ = socket(AF_INET, SOCK_STREAM, 0);
-			if (sec_sockfd_ < 0) {
-				print_fatal("ERROR opening secondary socket");
-			}
-			flag_ = 1;
-			setsockopt(sec_sockfd_, IPPROTO_TCP, TCP_NODELAY, (char *) &flag_,
-					sizeof(int));
-			setsockopt(sec_sockfd_, IPPROTO_TCP, TCP_QUICKACK, (char *) &flag_,
-					sizeof(int));
-			setsockopt(sec_sockfd_, SOL_SOCKET, SO_REUSEADDR, (char *) &flag_,
-					sizeof(int));
-			fcntl(sec_sockfd_, F_SETFL, O_NONBLOCK);
-			while (keepalive_ && !connected_) {
-				std::this_thread::sleep_for(std::chrono::seconds(10));
-				fd_set writefds;
+		reactor_->modify(sec_sockfd_, EPOLLIN | EPOLLRDHUP | EPOLLET);
+		connected_ = true;
+		print_info("Secondary port: Reconnected");
+		return;
+	}
+	// Edge triggered: read everything there is, even if the peer hung up
+	if (events & EPOLLIN)
+		readPackets();
+	if (connected_ && (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+		disconnected();
+}
 
-				connect(sec_sockfd_, (struct sockaddr *) &sec_serv_addr_,
-						sizeof(sec_serv_addr_));
-				FD_ZERO(&writefds);
-				FD_SET(sec_sockfd_, &writefds);
-				select(sec_sockfd_ + 1, NULL, &writefds, NULL, NULL);
-				unsigned int flag_len;
-				getsockopt(sec_sockfd_, SOL_SOCKET, SO_ERROR, &flag_,
-						&flag_len);
-				if (flag_ < 0) {
-					print_error("Error re-connecting to port 30002. Is controller started? Will try to reconnect in 10 seconds...");
-				} else {
-					connected_ = true;
-					print_info("Secondary port: Reconnected");
-				}
+void UrCommunication::readPackets() {
+	uint8_t * packet;
+	uint32_t packet_len;
+	int bytes_read;
+	while (connected_) {
+		// writePtr() may compact the buffer, so ask for the space afterwards
+		uint8_t * dst = framer_.writePtr();
+		bytes_read = read(sec_sockfd_, dst, framer_.writeSpace());
+		if (bytes_read > 0) {
+			setsockopt(sec_sockfd_, IPPROTO_TCP, TCP_QUICKACK,
+					(char *) &flag_, sizeof(int));
+			if (packet_log_ != NULL)
+				packet_log_->write(PACKET_LOG_SECONDARY, dst, bytes_read);
+			framer_.commit(bytes_read);
+			while (framer_.next(packet, packet_len)) {
+				robot_state_->unpack(packet, packet_len);
 			}
+			if (framer_.failed()) {
+				print_error("Secondary port: Invalid packet length, reconnecting to find the packet boundaries again");
+				disconnected();
+				return;
+			}
+		} else if (bytes_read < 0 && errno == EINTR) {
+			continue;
+		} else if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return;
+		} else {
+			disconnected();
 		}
 	}
+}
 
-	//wait for some traffic so the UR socket doesn't die in version 3.1.
-	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+void UrCommunication::disconnected() {
+	connected_ = false;
+	framer_.reset();
+	robot_state_->setDisconnected();
+	reactor_->remove(sec_sockfd_, this);
 	close(sec_sockfd_);
+	sec_sockfd_ = -1;
+	if (keepalive_) {
+		print_warning("Secondary port: No connection. Is controller crashed? Will try to reconnect in 10 seconds...");
+		reactor_->callAfter(10., this,
+				std::bind(&UrCommunication::reconnect, this));
+	}
 }
 
+void UrCommunication::reconnect() {
+	if (!keepalive_)
+		return;
+	openSecondarySocket();
+	if (connect(sec_sockfd_, (struct sockaddr *) &sec_serv_addr_,
+			sizeof(sec_serv_addr_)) < 0 && errno != EINPROGRESS) {
+		print_error("Error re-connecting to port 30002. Is controller started? Will try to reconnect in 10 seconds...");
+		close(sec_sockfd_);
+		sec_sockfd_ = -1;
+		reactor_->callAfter(10., this,
+				std::bind(&UrCommunication::reconnect, this));
+		return;
+	}
+	// Completion of the connect is reported as writability
+	connecting_ = true;
+	if (!reactor_->add(sec_sockfd_, EPOLLOUT | EPOLLIN | EPOLLRDHUP | EPOLLET,
+			this)) {
+		connecting_ = false;
+		close(sec_sockfd_);
+		sec_sockfd_ = -1;
+		reactor_->callAfter(10., this,
+				std::bind(&UrCommunication::reconnect, this));
+	}
+}
+
+void UrCommunication::setPacketLog(PacketLogWriter* log) {
+	packet_log_ = log;
+}
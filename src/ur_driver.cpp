@@ -18,11 +18,25 @@
 
 #include "ur_modern_driver/ur_driver.h"
 
+static void timespecAdd(struct timespec& ts, long ns) {
+	ts.tv_nsec += ns;
+	while (ts.tv_nsec >= 1000000000L) {
+		ts.tv_nsec -= 1000000000L;
+		ts.tv_sec += 1;
+	}
+}
+
+/* a - b in seconds */
+static double timespecDiff(const struct timespec& a, const struct timespec& b) {
+	return (a.tv_sec - b.tv_sec) + (a.tv_nsec - b.tv_nsec) / 1e9;
+}
+
 UrDriver::UrDriver(std::condition_variable& rt_msg_cond,
 		std::condition_variable& msg_cond, std::string host,
 		unsigned int reverse_port, double servoj_time,
 		unsigned int safety_count_max, double max_time_step, double min_payload,
-		double max_payload, double servoj_lookahead_time, double servoj_gain) :
+		double max_payload, double servoj_lookahead_time, double servoj_gain,
+		UrReactor* reactor) :
 		REVERSE_PORT_(reverse_port), maximum_time_step_(max_time_step), minimum_payload_(
 				min_payload), maximum_payload_(max_payload), servoj_time_(
 				servoj_time), servoj_lookahead_time_(servoj_lookahead_time), servoj_gain_(servoj_gain) {
@@ -32,11 +46,23 @@ UrDriver::UrDriver(std::condition_variable& rt_msg_cond,
 
 	firmware_version_ = 0;
 	reverse_connected_ = false;
+	keep_reverse_connection_ = false;
+	servo_idle_ = false;
+	buffered_traj_ = false;
+	servo_seq_ = 0;
+	recorder_ = NULL;
+	ack_len_ = 0;
+	acks_received_ = 0;
+	last_ack_ = 0;
+	memset(&servo_timing_, 0, sizeof(servo_timing_));
 	executing_traj_ = false;
-	rt_interface_ = new UrRealtimeCommunication(rt_msg_cond, host,
+	// Without a shared reactor every driver serves its own sockets
+	own_reactor_ = (reactor == NULL);
+	reactor_ = own_reactor_ ? new UrReactor() : reactor;
+	rt_interface_ = new UrRealtimeCommunication(rt_msg_cond, host, reactor_,
 			safety_count_max);
 	new_sockfd_ = -1;
-	sec_interface_ = new UrCommunication(msg_cond, host);
+	sec_interface_ = new UrCommunication(msg_cond, host, reactor_);
 
 	incoming_sockfd_ = socket(AF_INET, SOCK_STREAM, 0);
 	if (incoming_sockfd_ < 0) {
@@ -56,6 +82,12 @@ UrDriver::UrDriver(std::condition_variable& rt_msg_cond,
 		print_fatal("ERROR on binding socket for reverse communication");
 	}
 	listen(incoming_sockfd_, 5);
+	fcntl(incoming_sockfd_, F_SETFL, O_NONBLOCK);
+}
+
+UrDriver::~UrDriver() {
+	if (own_reactor_)
+		delete reactor_;
 }
 
 std::vector<double> UrDriver::interp_cubic(double t, double T,
@@ -78,66 +110,296 @@ std::vector<double> UrDriver::interp_cubic(double t, double T,
 bool UrDriver::doTraj(std::vector<double> inp_timestamps,
 		std::vector<std::vector<double> > inp_positions,
 		std::vector<std::vector<double> > inp_velocities) {
-	std::chrono::high_resolution_clock::time_point t0, t;
+	TrajectorySpline spline;
+	if (!spline.buildCubic(inp_timestamps, inp_positions, inp_velocities)) {
+		print_error("UrDriver::doTraj called with a malformed trajectory");
+		return false;
+	}
+	return UrDriver::doTraj(spline);
+}
+
+bool UrDriver::doTraj(TrajectorySpline& spline) {
+	if (buffered_traj_)
+		return UrDriver::doTrajBuffered(spline);
+
+	struct timespec t0, deadline, now;
+	// Every frame carries the setpoint that is due and the following ones,
+	// which the robot runs on its own if the next frame is late
+	std::vector<double> points(POINTS_PER_FRAME_ * spline.getJoints());
 	std::vector<double> positions;
-	unsigned int j;
+	servo_timing_stats stats;
+	double t, latency, latency_sum;
+	bool finished, lost;
+	const double duration = spline.getDuration();
 
+	spline.resetCursor();
 	if (!UrDriver::uploadProg()) {
 		return false;
 	}
 	executing_traj_ = true;
-	t0 = std::chrono::high_resolution_clock::now();
-	t = t0;
-	j = 0;
-	while ((inp_timestamps[inp_timestamps.size() - 1]
-			>= std::chrono::duration_cast<std::chrono::duration<double>>(t - t0).count())
-			and executing_traj_) {
-		while (inp_timestamps[j]
-				<= std::chrono::duration_cast<std::chrono::duration<double>>(
-						t - t0).count() && j < inp_timestamps.size() - 1) {
-			j += 1;
+	// One setpoint per servoj period on an absolute CLOCK_MONOTONIC grid, so
+	// neither wake-up jitter nor the time spent sending accumulates
+	const long period_ns = (long) (servoj_time_ * 1e9);
+	stats.cycles = 0;
+	stats.overruns = 0;
+	stats.min_latency = 0.;
+	stats.max_latency = 0.;
+	latency_sum = 0.;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	deadline = t0;
+	t = 0.;
+	// Every point of the frame goes forward on its own, so each gets its own
+	// cursor; sharing one would jump back a few ticks every frame
+	std::vector<unsigned int> cursors(POINTS_PER_FRAME_, 0);
+	lost = false;
+	while ((duration >= t) and executing_traj_) {
+		for (int k = 0; k < POINTS_PER_FRAME_; k++)
+			spline.sample(t + k * servoj_time_,
+					&points[k * spline.getJoints()], cursors[k]);
+		// Fails once the reverse connection is gone, nothing moves the robot then
+		if (!UrDriver::sendServoFrame(points.data(), POINTS_PER_FRAME_, t, 1)) {
+			lost = true;
+			break;
+		}
+		if (stats.cycles == 0)
+			traj_latency_.mark(TRACE_FIRST_SETPOINT);
+
+		timespecAdd(deadline, period_ns);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+				NULL) == EINTR) {
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		latency = timespecDiff(now, deadline);
+		if (stats.cycles == 0 || latency < stats.min_latency)
+			stats.min_latency = latency;
+		if (stats.cycles == 0 || latency > stats.max_latency)
+			stats.max_latency = latency;
+		latency_sum += latency;
+		stats.cycles += 1;
+		// Woke up a whole period late: skip the setpoints that are already due
+		while (latency >= servoj_time_) {
+			timespecAdd(deadline, period_ns);
+			latency -= servoj_time_;
+			stats.overruns += 1;
+		}
+		t = timespecDiff(deadline, t0);
+	}
+	// stopTraj() replaces driverProg() with stopj, so only a trajectory that
+	// ran to its end leaves a program behind that can be reused
+	finished = executing_traj_ and !lost;
+	executing_traj_ = false;
+	positions.assign(points.begin(), points.begin() + spline.getJoints());
+	if (lost) {
+		print_error("Lost the reverse connection during the trajectory");
+		UrDriver::closeReverseConnection();
+	} else if (finished and keep_reverse_connection_) {
+		spline.sample(duration, positions.data());
+		UrDriver::parkServo(positions);
+	} else
+		//Signal robot to stop driverProg()
+		UrDriver::closeServo(positions);
+
+	if (traj_latency_.finish())
+		print_debug(traj_latency_.lastToString());
+
+	stats.mean_latency = stats.cycles > 0 ? latency_sum / stats.cycles : 0.;
+	servo_timing_lock_.lock();
+	servo_timing_ = stats;
+	servo_timing_lock_.unlock();
+	char buf[256];
+	sprintf(buf,
+			"Servo timing: %lu cycles, %lu overruns, wake-up latency min %.1f us, mean %.1f us, max %.1f us",
+			stats.cycles, stats.overruns, stats.min_latency * 1e6,
+			stats.mean_latency * 1e6, stats.max_latency * 1e6);
+	print_debug(buf);
+	return !lost;
+}
+
+bool UrDriver::doTrajBuffered(TrajectorySpline& spline) {
+	std::vector<double> positions(spline.getJoints());
+	std::vector<int> setpoints(POINTS_PER_FRAME_ * 6, 0);
+	// One setpoint per servoj period, the last one clamped to the end
+	const int total = (int) ceil(spline.getDuration() / servoj_time_) + 1;
+	int sent, executed, n, cmd;
+	bool done_sent, ok;
+	unsigned long acks;
+
+	spline.resetCursor();
+	if (!UrDriver::uploadBufferedProg()) {
+		return false;
+	}
+	executing_traj_ = true;
+	reverse_lock_.lock();
+	acks = acks_received_;
+	reverse_lock_.unlock();
+	sent = 0;
+	executed = 0;
+	done_sent = false;
+	ok = true;
+	while (executing_traj_ and executed < total) {
+		n = 0;
+		if (sent < total
+				and sent - executed <= BUFFER_POINTS_ - POINTS_PER_FRAME_) {
+			n = std::min(POINTS_PER_FRAME_, total - sent);
+			for (int k = 0; k < n; k++) {
+				spline.sample((sent + k) * servoj_time_, positions.data());
+				for (int j = 0; j < 6; j++)
+					setpoints[k * 6 + j] = (int) (positions[j]
+							* MULT_JOINTSTATE_);
+			}
+			cmd = 1;
+		} else if (sent == total and !done_sent) {
+			cmd = 0;
+			done_sent = true;
+		} else {
+			// The buffer is full, only check on the controller from time to time
+			std::this_thread::sleep_for(
+					std::chrono::duration<double>(
+							POINTS_PER_FRAME_ * servoj_time_));
+			cmd = 2;
+		}
+		if (!UrDriver::sendBufferFrame(cmd, setpoints, n, acks)) {
+			ok = false;
+			break;
+		}
+		if (sent == 0)
+			traj_latency_.mark(TRACE_FIRST_SETPOINT);
+		sent += n;
+		reverse_lock_.lock();
+		executed = last_ack_;
+		reverse_lock_.unlock();
+		if (executed < 0) {
+			print_error(
+					"The trajectory buffer on the robot ran empty. Stopped the trajectory");
+			ok = false;
+			break;
 		}
-		positions = UrDriver::interp_cubic(
-				std::chrono::duration_cast<std::chrono::duration<double>>(
-						t - t0).count() - inp_timestamps[j - 1],
-				inp_timestamps[j] - inp_timestamps[j - 1], inp_positions[j - 1],
-				inp_positions[j], inp_velocities[j - 1], inp_velocities[j]);
-		UrDriver::servoj(positions);
-
-		// oversample with 4 * sample_time
-		std::this_thread::sleep_for(
-				std::chrono::milliseconds((int) ((servoj_time_ * 1000) / 4.)));
-		t = std::chrono::high_resolution_clock::now();
 	}
 	executing_traj_ = false;
-	//Signal robot to stop driverProg()
-	UrDriver::closeServo(positions);
+	if (traj_latency_.finish())
+		print_debug(traj_latency_.lastToString());
+	//Ends driverProg(), braking if the robot is still moving
+	UrDriver::sendBufferFrame(-1, setpoints, 0, acks);
+	UrDriver::closeReverseConnection();
+	return ok;
+}
+
+bool UrDriver::sendBufferFrame(int cmd, const std::vector<int>& setpoints,
+		int n, unsigned long& acks) {
+	// [cmd, n, n * 6 joint positions, zero padding]
+	const int frame_ints = 2 + 6 * POINTS_PER_FRAME_;
+	uint8_t buf[30 * 4];
+	uint32_t tmp;
+	memset(buf, 0, sizeof(buf));
+	tmp = htonl((uint32_t) cmd);
+	memcpy(&buf[0], &tmp, sizeof(tmp));
+	tmp = htonl((uint32_t) n);
+	memcpy(&buf[4], &tmp, sizeof(tmp));
+	for (int i = 0; i < n * 6; i++) {
+		tmp = htonl((uint32_t) setpoints[i]);
+		memcpy(&buf[8 + i * 4], &tmp, sizeof(tmp));
+	}
+	{
+		std::unique_lock<std::mutex> write_lock(write_lock_);
+		struct iovec iov;
+		int fd;
+		reverse_lock_.lock();
+		fd = reverse_connected_ ? new_sockfd_ : -1;
+		reverse_lock_.unlock();
+		if (fd < 0) {
+			print_error("Lost the reverse connection while buffering a trajectory");
+			return false;
+		}
+		iov.iov_base = buf;
+		iov.iov_len = frame_ints * 4;
+		if (!UrDriver::writeReverse(fd, &iov, 1, write_lock)) {
+			print_error("Could not send trajectory setpoints to the robot");
+			return false;
+		}
+	}
+	if (cmd < 0)
+		return true; // driverProg() exits without answering
+	if (!UrDriver::waitForAck(acks + 1)) {
+		print_error("The robot didn't acknowledge trajectory setpoints in time");
+		return false;
+	}
+	acks += 1;
 	return true;
 }
 
-void UrDriver::servoj(std::vector<double> positions, int keepalive) {
-	if (!reverse_connected_) {
+bool UrDriver::waitForAck(unsigned long acks) {
+	std::unique_lock<std::mutex> lock(reverse_lock_);
+	return reverse_cond_.wait_for(lock,
+			std::chrono::duration<double>(ACK_TIMEOUT_),
+			[this, acks] {return acks_received_ >= acks || !reverse_connected_;})
+			&& acks_received_ >= acks;
+}
+
+void UrDriver::readAcks() {
+	// The controller answers every buffer frame with the number of
+	// setpoints it has executed, as a big-endian int (socket_send_int)
+	int bytes_read;
+	uint32_t tmp;
+	while ((bytes_read = recv(new_sockfd_, ack_buf_ + ack_len_,
+			sizeof(ack_buf_) - ack_len_, MSG_DONTWAIT)) > 0) {
+		ack_len_ += bytes_read;
+		if (ack_len_ == sizeof(ack_buf_)) {
+			memcpy(&tmp, ack_buf_, sizeof(tmp));
+			last_ack_ = (int) ntohl(tmp);
+			acks_received_ += 1;
+			ack_len_ = 0;
+		}
+	}
+	reverse_cond_.notify_all();
+}
+
+void UrDriver::servoj(const std::vector<double>& positions, int keepalive) {
+	UrDriver::sendServoFrame(positions.data(), 1, 0., keepalive);
+}
+
+bool UrDriver::sendServoFrame(const double* points, int n, double t,
+		int keepalive) {
+	// [version, sequence, time in us, n, keepalive] followed by n setpoints,
+	// padded to the fixed size driverProg() reads
+	uint32_t header[5];
+	uint32_t body[6 * 4];
+	struct iovec iov[2];
+	int fd, seq;
+	std::unique_lock<std::mutex> write_lock(write_lock_);
+	reverse_lock_.lock();
+	fd = reverse_connected_ ? new_sockfd_ : -1;
+	seq = servo_seq_ += 1;
+	reverse_lock_.unlock();
+	if (fd < 0) {
 		print_error(
 				"UrDriver::servoj called without a reverse connection present. Keepalive: "
 						+ std::to_string(keepalive));
-		return;
+		return false;
 	}
-	unsigned int bytes_written;
-	int tmp;
-	unsigned char buf[28];
-	for (int i = 0; i < 6; i++) {
-		tmp = htonl((int) (positions[i] * MULT_JOINTSTATE_));
-		buf[i * 4] = tmp & 0xff;
-		buf[i * 4 + 1] = (tmp >> 8) & 0xff;
-		buf[i * 4 + 2] = (tmp >> 16) & 0xff;
-		buf[i * 4 + 3] = (tmp >> 24) & 0xff;
+	header[0] = htonl((uint32_t) SERVO_PROTOCOL_VERSION_);
+	header[1] = htonl((uint32_t) seq);
+	header[2] = htonl((uint32_t) (int) (t * MULT_TIME_));
+	header[3] = htonl((uint32_t) n);
+	header[4] = htonl((uint32_t) keepalive);
+	memset(body, 0, sizeof(body));
+	for (int i = 0; i < n * 6; i++)
+		body[i] = htonl((uint32_t) (int) (points[i] * MULT_JOINTSTATE_));
+	iov[0].iov_base = header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = body;
+	iov[1].iov_len = sizeof(body);
+	if (!UrDriver::writeReverse(fd, iov, 2, write_lock)) {
+		print_warning("Could not send the servo setpoints to the robot");
+		return false;
 	}
-	tmp = htonl((int) keepalive);
-	buf[6 * 4] = tmp & 0xff;
-	buf[6 * 4 + 1] = (tmp >> 8) & 0xff;
-	buf[6 * 4 + 2] = (tmp >> 16) & 0xff;
-	buf[6 * 4 + 3] = (tmp >> 24) & 0xff;
-	bytes_written = write(new_sockfd_, buf, 28);
+	if (recorder_ != NULL)
+		recorder_->recordServo(points, n, t);
+	return true;
+}
+
+servo_timing_stats UrDriver::getServoTimingStats() {
+	std::lock_guard<std::mutex> lock(servo_timing_lock_);
+	return servo_timing_;
 }
 
 void UrDriver::stopTraj() {
@@ -146,106 +408,381 @@ void UrDriver::stopTraj() {
 }
 
 bool UrDriver::uploadProg() {
+	/*
+	 * The servo thread runs the first setpoint of every new frame. If no
+	 * new frame has arrived by the next period it continues with the
+	 * following setpoints of the last frame, and brakes when they are used
+	 * up as well. Without new frames it stays connected and idle, so the
+	 * program of the last trajectory can be reused for the next one.
+	 */
 	std::string cmd_str;
 	char buf[128];
+	bool stale = false;
+	if (keep_reverse_connection_) {
+		std::lock_guard<std::mutex> lock(reverse_lock_);
+		// Any other program started on the robot has replaced driverProg()
+		if (servo_idle_ and reverse_connected_
+				and sec_interface_->robot_state_->isProgramRunning()) {
+			servo_idle_ = false;
+			traj_latency_.mark(TRACE_PROGRAM_SENT);
+			traj_latency_.mark(TRACE_REVERSE_CONNECTED);
+			return true;
+		}
+		stale = reverse_connected_;
+		servo_idle_ = false;
+	}
+	// The new program connects again, openServo() must not take the old socket
+	if (stale)
+		UrDriver::closeReverseConnection();
 	cmd_str = "def driverProg():\n";
 
 	sprintf(buf, "\tMULT_jointstate = %i\n", MULT_JOINTSTATE_);
 	cmd_str += buf;
+	sprintf(buf, "\tPROTOCOL_VERSION = %i\n", SERVO_PROTOCOL_VERSION_);
+	cmd_str += buf;
 
-	cmd_str += "\tSERVO_IDLE = 0\n";
-	cmd_str += "\tSERVO_RUNNING = 1\n";
-	cmd_str += "\tcmd_servo_state = SERVO_IDLE\n";
-	cmd_str += "\tcmd_servo_q = [0.0, 0.0, 0.0, 0.0, 0.0, 0.0]\n";
-	cmd_str += "\tdef set_servo_setpoint(q):\n";
+	// socket_read_binary_integer() result: [count, header..., setpoints...]
+	cmd_str += "\tcmd_frame = [0";
+	for (int i = 1; i < 1 + SERVO_HEADER_INTS_ + 6 * POINTS_PER_FRAME_; i++)
+		cmd_str += ", 0";
+	cmd_str += "]\n";
+	cmd_str += "\tdef set_servo_frame(frame):\n";
 	cmd_str += "\t\tenter_critical\n";
-	cmd_str += "\t\tcmd_servo_state = SERVO_RUNNING\n";
-	cmd_str += "\t\tcmd_servo_q = q\n";
+	cmd_str += "\t\tcmd_frame = frame\n";
 	cmd_str += "\t\texit_critical\n";
 	cmd_str += "\tend\n";
 	cmd_str += "\tthread servoThread():\n";
-	cmd_str += "\t\tstate = SERVO_IDLE\n";
+	cmd_str += "\t\tseq = 0\n";
+	cmd_str += "\t\tindex = 0\n";
+	cmd_str += "\t\trunning = False\n";
 	cmd_str += "\t\twhile True:\n";
 	cmd_str += "\t\t\tenter_critical\n";
-	cmd_str += "\t\t\tq = cmd_servo_q\n";
-	cmd_str += "\t\t\tdo_brake = False\n";
-	cmd_str += "\t\t\tif (state == SERVO_RUNNING) and ";
-	cmd_str += "(cmd_servo_state == SERVO_IDLE):\n";
-	cmd_str += "\t\t\t\tdo_brake = True\n";
-	cmd_str += "\t\t\tend\n";
-	cmd_str += "\t\t\tstate = cmd_servo_state\n";
-	cmd_str += "\t\t\tcmd_servo_state = SERVO_IDLE\n";
+	cmd_str += "\t\t\tframe = cmd_frame\n";
 	cmd_str += "\t\t\texit_critical\n";
-	cmd_str += "\t\t\tif do_brake:\n";
+	cmd_str += "\t\t\tif frame[2] != seq:\n";
+	cmd_str += "\t\t\t\tseq = frame[2]\n";
+	cmd_str += "\t\t\t\tindex = 0\n";
+	cmd_str += "\t\t\telse:\n";
+	cmd_str += "\t\t\t\tindex = index + 1\n";
+	cmd_str += "\t\t\tend\n";
+	cmd_str += "\t\t\tif index < frame[4]:\n";
+	sprintf(buf, "\t\t\t\tk = %i + index * 6\n", 1 + SERVO_HEADER_INTS_);
+	cmd_str += buf;
+	cmd_str += "\t\t\t\tq = [frame[k] / MULT_jointstate, ";
+	cmd_str += "frame[k + 1] / MULT_jointstate, ";
+	cmd_str += "frame[k + 2] / MULT_jointstate, ";
+	cmd_str += "frame[k + 3] / MULT_jointstate, ";
+	cmd_str += "frame[k + 4] / MULT_jointstate, ";
+	cmd_str += "frame[k + 5] / MULT_jointstate]\n";
+	cmd_str += "\t\t\t\t" + servojCall() + "\n";
+	cmd_str += "\t\t\t\trunning = True\n";
+	cmd_str += "\t\t\telif running:\n";
 	cmd_str += "\t\t\t\tstopj(1.0)\n";
 	cmd_str += "\t\t\t\tsync()\n";
-	cmd_str += "\t\t\telif state == SERVO_RUNNING:\n";
+	cmd_str += "\t\t\t\trunning = False\n";
+	cmd_str += "\t\t\telse:\n";
+	cmd_str += "\t\t\t\tsync()\n";
+	cmd_str += "\t\t\tend\n";
+	cmd_str += "\t\tend\n";
+	cmd_str += "\tend\n";
+
+	sprintf(buf, "\tsocket_open(\"%s\", %i)\n", ip_addr_.c_str(),
+			REVERSE_PORT_);
+	cmd_str += buf;
+
+	cmd_str += "\tthread_servo = run servoThread()\n";
+	cmd_str += "\tkeepalive = 1\n";
+	cmd_str += "\twhile keepalive > 0:\n";
+	sprintf(buf, "\t\tparams_mult = socket_read_binary_integer(%i)\n",
+			SERVO_HEADER_INTS_ + 6 * POINTS_PER_FRAME_);
+	cmd_str += buf;
+	cmd_str += "\t\tif params_mult[0] > 0:\n";
+	cmd_str += "\t\t\tif params_mult[1] != PROTOCOL_VERSION:\n";
+	cmd_str += "\t\t\t\ttextmsg(\"driverProg: unknown frame version \", params_mult[1])\n";
+	cmd_str += "\t\t\t\tkeepalive = 0\n";
+	cmd_str += "\t\t\telse:\n";
+	cmd_str += "\t\t\t\tkeepalive = params_mult[5]\n";
+	cmd_str += "\t\t\t\tset_servo_frame(params_mult)\n";
+	cmd_str += "\t\t\tend\n";
+	cmd_str += "\t\tend\n";
+	cmd_str += "\tend\n";
+	cmd_str += "\tsleep(.1)\n";
+	cmd_str += "\tsocket_close()\n";
+	cmd_str += "\tkill thread_servo\n";
+	cmd_str += "end\n";
 
+	rt_interface_->addCommandToQueue(cmd_str);
+	traj_latency_.mark(TRACE_PROGRAM_SENT);
+	return UrDriver::openServo();
+}
+
+std::string UrDriver::servojCall() {
+	char buf[128];
 	if (sec_interface_->robot_state_->getVersion() >= 3.1)
-		sprintf(buf, "\t\t\t\tservoj(q, t=%.4f, lookahead_time=%.4f, gain=%.0f)\n",
+		sprintf(buf, "servoj(q, t=%.4f, lookahead_time=%.4f, gain=%.0f)",
 				servoj_time_, servoj_lookahead_time_, servoj_gain_);
 	else
-		sprintf(buf, "\t\t\t\tservoj(q, t=%.4f)\n", servoj_time_);
-	cmd_str += buf;
+		sprintf(buf, "servoj(q, t=%.4f)", servoj_time_);
+	return buf;
+}
+
+bool UrDriver::uploadBufferedProg() {
+	/*
+	 * The robot keeps BUFFER_POINTS_ setpoints in a ring buffer and runs
+	 * them one per servoj period on its own, so the host only has to keep
+	 * the buffer filled. Every frame the host sends is answered with the
+	 * number of setpoints executed so far, or -1 if the buffer ran empty.
+	 */
+	std::string cmd_str;
+	char buf[128];
+	cmd_str = "def driverProg():\n";
 
+	sprintf(buf, "\tMULT_jointstate = %i\n", MULT_JOINTSTATE_);
+	cmd_str += buf;
+	sprintf(buf, "\tBUFFER_LEN = %i\n", BUFFER_POINTS_);
+	cmd_str += buf;
+	cmd_str += "\tbuffer = [0";
+	for (int i = 1; i < BUFFER_POINTS_ * 6; i++)
+		cmd_str += ", 0";
+	cmd_str += "]\n";
+	cmd_str += "\twrite_index = 0\n";
+	cmd_str += "\tread_index = 0\n";
+	cmd_str += "\tstream_done = False\n";
+	cmd_str += "\tservo_running = False\n";
+	cmd_str += "\tunderrun = False\n";
+	cmd_str += "\tthread servoThread():\n";
+	cmd_str += "\t\twhile True:\n";
+	cmd_str += "\t\t\tenter_critical\n";
+	cmd_str += "\t\t\tavailable = write_index - read_index\n";
+	cmd_str += "\t\t\tdone = stream_done\n";
+	cmd_str += "\t\t\texit_critical\n";
+	cmd_str += "\t\t\tif available > 0:\n";
+	cmd_str += "\t\t\t\ti = (read_index % BUFFER_LEN) * 6\n";
+	cmd_str += "\t\t\t\tq = [buffer[i] / MULT_jointstate, ";
+	cmd_str += "buffer[i + 1] / MULT_jointstate, ";
+	cmd_str += "buffer[i + 2] / MULT_jointstate, ";
+	cmd_str += "buffer[i + 3] / MULT_jointstate, ";
+	cmd_str += "buffer[i + 4] / MULT_jointstate, ";
+	cmd_str += "buffer[i + 5] / MULT_jointstate]\n";
+	cmd_str += "\t\t\t\t" + servojCall() + "\n";
+	cmd_str += "\t\t\t\tenter_critical\n";
+	cmd_str += "\t\t\t\tread_index = read_index + 1\n";
+	cmd_str += "\t\t\t\texit_critical\n";
 	cmd_str += "\t\t\telse:\n";
-	cmd_str += "\t\t\t\tsync()\n";
+	cmd_str += "\t\t\t\tif not done:\n";
+	cmd_str += "\t\t\t\t\tunderrun = True\n";
+	cmd_str += "\t\t\t\t\tstopj(1.0)\n";
+	cmd_str += "\t\t\t\tend\n";
+	cmd_str += "\t\t\t\tbreak\n";
 	cmd_str += "\t\t\tend\n";
 	cmd_str += "\t\tend\n";
+	cmd_str += "\t\tservo_running = False\n";
 	cmd_str += "\tend\n";
 
 	sprintf(buf, "\tsocket_open(\"%s\", %i)\n", ip_addr_.c_str(),
 			REVERSE_PORT_);
 	cmd_str += buf;
 
-	cmd_str += "\tthread_servo = run servoThread()\n";
 	cmd_str += "\tkeepalive = 1\n";
+	cmd_str += "\tstarted = False\n";
 	cmd_str += "\twhile keepalive > 0:\n";
-	cmd_str += "\t\tparams_mult = socket_read_binary_integer(6+1)\n";
+	sprintf(buf, "\t\tparams_mult = socket_read_binary_integer(%i)\n",
+			2 + 6 * POINTS_PER_FRAME_);
+	cmd_str += buf;
 	cmd_str += "\t\tif params_mult[0] > 0:\n";
-	cmd_str += "\t\t\tq = [params_mult[1] / MULT_jointstate, ";
-	cmd_str += "params_mult[2] / MULT_jointstate, ";
-	cmd_str += "params_mult[3] / MULT_jointstate, ";
-	cmd_str += "params_mult[4] / MULT_jointstate, ";
-	cmd_str += "params_mult[5] / MULT_jointstate, ";
-	cmd_str += "params_mult[6] / MULT_jointstate]\n";
-	cmd_str += "\t\t\tkeepalive = params_mult[7]\n";
-	cmd_str += "\t\t\tset_servo_setpoint(q)\n";
+	cmd_str += "\t\t\tcmd = params_mult[1]\n";
+	cmd_str += "\t\t\tif cmd == 1:\n";
+	cmd_str += "\t\t\t\tj = 0\n";
+	cmd_str += "\t\t\t\twhile j < params_mult[2]:\n";
+	cmd_str += "\t\t\t\t\ti = (write_index % BUFFER_LEN) * 6\n";
+	cmd_str += "\t\t\t\t\tk = 3 + j * 6\n";
+	cmd_str += "\t\t\t\t\tbuffer[i] = params_mult[k]\n";
+	cmd_str += "\t\t\t\t\tbuffer[i + 1] = params_mult[k + 1]\n";
+	cmd_str += "\t\t\t\t\tbuffer[i + 2] = params_mult[k + 2]\n";
+	cmd_str += "\t\t\t\t\tbuffer[i + 3] = params_mult[k + 3]\n";
+	cmd_str += "\t\t\t\t\tbuffer[i + 4] = params_mult[k + 4]\n";
+	cmd_str += "\t\t\t\t\tbuffer[i + 5] = params_mult[k + 5]\n";
+	cmd_str += "\t\t\t\t\tenter_critical\n";
+	cmd_str += "\t\t\t\t\twrite_index = write_index + 1\n";
+	cmd_str += "\t\t\t\t\texit_critical\n";
+	cmd_str += "\t\t\t\t\tj = j + 1\n";
+	cmd_str += "\t\t\t\tend\n";
+	cmd_str += "\t\t\telif cmd == 0:\n";
+	cmd_str += "\t\t\t\tenter_critical\n";
+	cmd_str += "\t\t\t\tstream_done = True\n";
+	cmd_str += "\t\t\t\texit_critical\n";
+	cmd_str += "\t\t\telif cmd < 0:\n";
+	cmd_str += "\t\t\t\tkeepalive = 0\n";
+	cmd_str += "\t\t\tend\n";
+	// Start moving once half the buffer is filled, or all of a short trajectory
+	cmd_str += "\t\t\tif (not started) and (keepalive > 0) and ";
+	cmd_str += "((write_index >= BUFFER_LEN / 2) or stream_done):\n";
+	cmd_str += "\t\t\t\tservo_running = True\n";
+	cmd_str += "\t\t\t\tthread_servo = run servoThread()\n";
+	cmd_str += "\t\t\t\tstarted = True\n";
+	cmd_str += "\t\t\tend\n";
+	cmd_str += "\t\t\tif keepalive > 0:\n";
+	cmd_str += "\t\t\t\tif underrun:\n";
+	cmd_str += "\t\t\t\t\tsocket_send_int(-1)\n";
+	cmd_str += "\t\t\t\telse:\n";
+	cmd_str += "\t\t\t\t\tsocket_send_int(read_index)\n";
+	cmd_str += "\t\t\t\tend\n";
+	cmd_str += "\t\t\tend\n";
 	cmd_str += "\t\tend\n";
 	cmd_str += "\tend\n";
+	cmd_str += "\tif servo_running:\n";
+	cmd_str += "\t\tkill thread_servo\n";
+	cmd_str += "\t\tstopj(1.0)\n";
+	cmd_str += "\tend\n";
 	cmd_str += "\tsleep(.1)\n";
 	cmd_str += "\tsocket_close()\n";
-	cmd_str += "\tkill thread_servo\n";
 	cmd_str += "end\n";
 
 	rt_interface_->addCommandToQueue(cmd_str);
+	traj_latency_.mark(TRACE_PROGRAM_SENT);
 	return UrDriver::openServo();
 }
 
 bool UrDriver::openServo() {
-	struct sockaddr_in cli_addr;
-	socklen_t clilen;
-	clilen = sizeof(cli_addr);
-	new_sockfd_ = accept(incoming_sockfd_, (struct sockaddr *) &cli_addr,
-			&clilen);
-	if (new_sockfd_ < 0) {
-		print_fatal("ERROR on accepting reverse communication");
+	// The reverse connection is accepted on the reactor thread
+	std::unique_lock<std::mutex> lock(reverse_lock_);
+	if (!reverse_cond_.wait_for(lock,
+			std::chrono::duration<double>(REVERSE_CONNECT_TIMEOUT_),
+			[this] {return reverse_connected_;})) {
+		print_error("Timed out waiting for the reverse connection from the robot");
 		return false;
 	}
-	reverse_connected_ = true;
+	traj_latency_.mark(TRACE_REVERSE_CONNECTED);
 	return true;
 }
+
 void UrDriver::closeServo(std::vector<double> positions) {
 	if (positions.size() != 6)
 		UrDriver::servoj(rt_interface_->robot_state_->getQActual(), 0);
 	else
 		UrDriver::servoj(positions, 0);
 
+	UrDriver::closeReverseConnection();
+}
+
+void UrDriver::parkServo(const std::vector<double>& positions) {
+	// The last setpoint is held and driverProg() waits for the next frame
+	UrDriver::servoj(positions, 1);
+	std::lock_guard<std::mutex> lock(reverse_lock_);
+	servo_idle_ = reverse_connected_;
+}
+
+/*
+ * The reverse socket is non-blocking, so a robot that stops reading can't
+ * block the caller. A frame that doesn't fit the send buffer in one go
+ * means the connection is stalled; it is dropped then, as half a frame
+ * can't be taken back. Called with write_lock_ held, which is released
+ * before a dropped socket is removed from the reactor (the reactor thread
+ * takes write_lock_ while it holds its own lock).
+ */
+bool UrDriver::writeReverse(int fd, const struct iovec* iov, int iovcnt,
+		std::unique_lock<std::mutex>& write_lock) {
+	ssize_t len = 0, written;
+	for (int i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	do {
+		written = writev(fd, iov, iovcnt);
+	} while (written < 0 && errno == EINTR);
+	if (written == len)
+		return true;
+	if (written >= 0 || errno == EAGAIN || errno == EWOULDBLOCK)
+		print_error("The robot doesn't read the reverse connection anymore, closing it");
+	reverse_lock_.lock();
+	if (new_sockfd_ != fd) {
+		reverse_lock_.unlock();
+		return false;
+	}
 	reverse_connected_ = false;
-	close(new_sockfd_);
+	servo_idle_ = false;
+	new_sockfd_ = -1;
+	reverse_lock_.unlock();
+	write_lock.unlock();
+	reverse_cond_.notify_all();
+	// Not new_sockfd_ anymore, so only we close it
+	reactor_->remove(fd, this);
+	close(fd);
+	return false;
+}
+
+void UrDriver::closeReverseConnection() {
+	int fd;
+	{
+		std::lock_guard<std::mutex> write_lock(write_lock_);
+		std::lock_guard<std::mutex> lock(reverse_lock_);
+		reverse_connected_ = false;
+		servo_idle_ = false;
+		fd = new_sockfd_;
+		new_sockfd_ = -1;
+	}
+	// Not under reverse_lock_, the reactor holds its own lock while it calls us
+	if (fd >= 0) {
+		reactor_->remove(fd, this);
+		close(fd);
+	}
+}
+
+void UrDriver::onEvent(int fd, uint32_t events) {
+	if (fd == incoming_sockfd_) {
+		struct sockaddr_in cli_addr;
+		socklen_t clilen;
+		int sockfd;
+		for (;;) {
+			clilen = sizeof(cli_addr);
+			sockfd = accept(incoming_sockfd_, (struct sockaddr *) &cli_addr,
+					&clilen);
+			if (sockfd < 0) {
+				if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+					print_error("ERROR on accepting reverse communication");
+				if (errno != EINTR)
+					return;
+				continue;
+			}
+			// Non-blocking, see writeReverse()
+			fcntl(sockfd, F_SETFL, O_NONBLOCK);
+			std::lock_guard<std::mutex> write_lock(write_lock_);
+			std::lock_guard<std::mutex> lock(reverse_lock_);
+			if (new_sockfd_ >= 0) {
+				print_warning("New reverse connection replaces a stale one");
+				reactor_->remove(new_sockfd_, this);
+				close(new_sockfd_);
+			}
+			new_sockfd_ = sockfd;
+			reverse_connected_ = true;
+			servo_idle_ = false;
+			ack_len_ = 0;
+			last_ack_ = 0;
+			// Acks of the buffered mode, and hangups
+			reactor_->add(new_sockfd_, EPOLLIN | EPOLLRDHUP | EPOLLET, this);
+			reverse_cond_.notify_all();
+		}
+	}
+	if (events & EPOLLIN) {
+		std::lock_guard<std::mutex> lock(reverse_lock_);
+		if (fd == new_sockfd_)
+			readAcks();
+	}
+	if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+		std::lock_guard<std::mutex> write_lock(write_lock_);
+		std::lock_guard<std::mutex> lock(reverse_lock_);
+		if (fd != new_sockfd_)
+			return;
+		print_warning("Reverse connection closed by the robot");
+		reverse_connected_ = false;
+		servo_idle_ = false;
+		reactor_->remove(new_sockfd_, this);
+		close(new_sockfd_);
+		new_sockfd_ = -1;
+	}
 }
 
 bool UrDriver::start() {
+	if (own_reactor_ && !reactor_->start())
+		return false;
 	if (!sec_interface_->start())
 		return false;
 	firmware_version_ = sec_interface_->robot_state_->getVersion();
@@ -253,6 +790,8 @@ bool UrDriver::start() {
 	if (!rt_interface_->start())
 		return false;
 	ip_addr_ = rt_interface_->getLocalIp();
+	if (!reactor_->add(incoming_sockfd_, EPOLLIN, this))
+		return false;
 	print_debug(
 			"Listening on " + ip_addr_ + ":" + std::to_string(REVERSE_PORT_)
 					+ "\n");
@@ -261,12 +800,27 @@ bool UrDriver::start() {
 }
 
 void UrDriver::halt() {
+	bool idle;
 	if (executing_traj_) {
 		UrDriver::stopTraj();
 	}
+	reverse_lock_.lock();
+	idle = servo_idle_;
+	reverse_lock_.unlock();
+	if (idle) {
+		//End the driverProg() kept waiting for trajectories
+		std::vector<double> tmp;
+		UrDriver::closeServo(tmp);
+	}
 	sec_interface_->halt();
 	rt_interface_->halt();
-	close(incoming_sockfd_);
+	if (incoming_sockfd_ >= 0) {
+		reactor_->remove(incoming_sockfd_, this);
+		close(incoming_sockfd_);
+		incoming_sockfd_ = -1;
+	}
+	if (own_reactor_)
+		reactor_->halt();
 }
 
 void UrDriver::setSpeed(double q0, double q1, double q2, double q3, double q4,
@@ -369,6 +923,23 @@ void UrDriver::setServojLookahead(double t){
 		servoj_lookahead_time_ = 0.03;
 	}
 }
+void UrDriver::setBufferedTrajectory(bool buffered) {
+	buffered_traj_ = buffered;
+}
+void UrDriver::setKeepReverseConnection(bool keep) {
+	keep_reverse_connection_ = keep;
+}
+void UrDriver::setPacketLog(PacketLogWriter* log) {
+	// Before start(), so the firmware version is recorded too
+	sec_interface_->setPacketLog(log);
+	rt_interface_->setPacketLog(log);
+}
+
+void UrDriver::setFlightRecorder(FlightRecorder* recorder) {
+	recorder_ = recorder;
+	rt_interface_->setFlightRecorder(recorder);
+}
+
 void UrDriver::setServojGain(double g){
 	if (g > 100) {
 			if (g < 2000) {
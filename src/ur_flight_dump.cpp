@@ -0,0 +1,73 @@
+/*
+ * ur_flight_dump.cpp
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Prints the records of a flight recorder ring or dump as CSV, oldest
+ * first. Times are in seconds relative to the first record.
+ *
+ * Usage: ur_flight_dump <file>
+ */
+
+#include "ur_modern_driver/flight_recorder.h"
+#include <stdio.h>
+
+static const char* typeName(uint32_t type) {
+	switch (type) {
+	case FLIGHT_RECORD_RT:
+		return "rt";
+	case FLIGHT_RECORD_SERVOJ:
+		return "servoj";
+	case FLIGHT_RECORD_SPEEDJ:
+		return "speedj";
+	}
+	return "unknown";
+}
+
+int main(int argc, char **argv) {
+	std::vector<flight_record> records;
+	unsigned int values;
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <file>\n", argv[0]);
+		return 1;
+	}
+	if (!FlightRecorder::read(argv[1], records))
+		return 1;
+
+	printf("host_time,type,count,time,robot_mode,safety_mode,speed_scaling");
+	for (unsigned int i = 0; i < 36; i++)
+		printf(",v%u", i);
+	printf("\n");
+	for (unsigned int i = 0; i < records.size(); i++) {
+		const flight_record& r = records[i];
+		printf("%.6f,%s,%u,%.6f,%g,%g,%g",
+				(r.time_ns - records[0].time_ns) / 1e9, typeName(r.type),
+				r.count, r.time, r.robot_mode, r.safety_mode, r.speed_scaling);
+		// Only the setpoints a command carried, the rest of the row stays empty
+		values = 36;
+		if (r.type == FLIGHT_RECORD_SERVOJ || r.type == FLIGHT_RECORD_SPEEDJ)
+			values = r.count * 6 < 36 ? r.count * 6 : 36;
+		for (unsigned int j = 0; j < 36; j++) {
+			if (j < values)
+				printf(",%.6f", r.values[j]);
+			else
+				printf(",");
+		}
+		printf("\n");
+	}
+	return 0;
+}
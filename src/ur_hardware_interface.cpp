@@ -129,19 +129,20 @@ void UrHardwareInterface::init() {
 }
 
 void UrHardwareInterface::read() {
-	std::vector<double> pos, vel, current, tcp;
-	pos = robot_->rt_interface_->robot_state_->getQActual();
-	vel = robot_->rt_interface_->robot_state_->getQdActual();
-	current = robot_->rt_interface_->robot_state_->getIActual();
-	tcp = robot_->rt_interface_->robot_state_->getTcpForce();
+	robot_state_rt_data state;
+	robot_->rt_interface_->robot_state_->snapshot(state);
+	read(state);
+}
+
+void UrHardwareInterface::read(const robot_state_rt_data& state) {
 	for (std::size_t i = 0; i < num_joints_; ++i) {
-		joint_position_[i] = pos[i];
-		joint_velocity_[i] = vel[i];
-		joint_effort_[i] = current[i];
+		joint_position_[i] = state.q_actual[i];
+		joint_velocity_[i] = state.qd_actual[i];
+		joint_effort_[i] = state.i_actual[i];
 	}
 	for (std::size_t i = 0; i < 3; ++i) {
-		robot_force_[i] = tcp[i];
-		robot_torque_[i] = tcp[i + 3];
+		robot_force_[i] = state.tcp_force[i];
+		robot_torque_[i] = state.tcp_force[i + 3];
 	}
 
 }
@@ -0,0 +1,190 @@
+/*
+ * ur_reactor.cpp
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ur_modern_driver/ur_reactor.h"
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+UrReactor::UrReactor() {
+	keepalive_ = false;
+	epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd_ < 0) {
+		print_fatal("ERROR creating epoll instance");
+	}
+	wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd_ < 0) {
+		print_fatal("ERROR creating eventfd for the reactor");
+	}
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = wake_fd_;
+	epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+}
+
+UrReactor::~UrReactor() {
+	halt();
+	close(wake_fd_);
+	close(epoll_fd_);
+}
+
+bool UrReactor::start() {
+	if (keepalive_)
+		return true;
+	keepalive_ = true;
+	thread_ = std::thread(&UrReactor::run, this);
+	return true;
+}
+
+void UrReactor::halt() {
+	if (!keepalive_)
+		return;
+	keepalive_ = false;
+	wake();
+	thread_.join();
+}
+
+bool UrReactor::isRunning() {
+	return keepalive_;
+}
+
+std::thread& UrReactor::getThread() {
+	return thread_;
+}
+
+void UrReactor::wake() {
+	uint64_t one = 1;
+	ssize_t bytes_written = write(wake_fd_, &one, sizeof(one));
+	(void) bytes_written;
+}
+
+bool UrReactor::add(int fd, uint32_t events, UrReactorHandler* handler) {
+	std::lock_guard<std::recursive_mutex> lock(handlers_lock_);
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fd;
+	if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		print_error("Could not add socket to the reactor: "
+				+ std::string(strerror(errno)));
+		return false;
+	}
+	handlers_[fd] = handler;
+	return true;
+}
+
+bool UrReactor::modify(int fd, uint32_t events) {
+	std::lock_guard<std::recursive_mutex> lock(handlers_lock_);
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fd;
+	return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+bool UrReactor::remove(int fd, UrReactorHandler* handler) {
+	std::lock_guard<std::recursive_mutex> lock(handlers_lock_);
+	// The fd may already be closed and reused by another handler
+	std::map<int, UrReactorHandler*>::iterator it = handlers_.find(fd);
+	if (it == handlers_.end() || it->second != handler)
+		return false;
+	handlers_.erase(it);
+	epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+	return true;
+}
+
+void UrReactor::callAfter(double seconds, UrReactorHandler* owner,
+		std::function<void()> fn) {
+	std::lock_guard<std::recursive_mutex> lock(handlers_lock_);
+	timer t;
+	t.deadline = std::chrono::steady_clock::now()
+			+ std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+					std::chrono::duration<double>(seconds));
+	t.owner = owner;
+	t.fn = fn;
+	timers_.push_back(t);
+	wake();
+}
+
+void UrReactor::cancelTimers(UrReactorHandler* owner) {
+	std::lock_guard<std::recursive_mutex> lock(handlers_lock_);
+	for (unsigned int i = 0; i < timers_.size();) {
+		if (timers_[i].owner == owner)
+			timers_.erase(timers_.begin() + i);
+		else
+			i++;
+	}
+}
+
+int UrReactor::runTimers() {
+	/* Runs the expired timers and returns the epoll timeout until the next one */
+	std::chrono::steady_clock::time_point now =
+			std::chrono::steady_clock::now();
+	for (unsigned int i = 0; i < timers_.size();) {
+		if (timers_[i].deadline <= now) {
+			std::function<void()> fn = timers_[i].fn;
+			timers_.erase(timers_.begin() + i);
+			fn(); // may add or cancel timers
+			i = 0;
+		} else {
+			i++;
+		}
+	}
+	int timeout = -1;
+	for (unsigned int i = 0; i < timers_.size(); i++) {
+		int ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+				timers_[i].deadline - now).count() + 1;
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+	return timeout;
+}
+
+void UrReactor::run() {
+	const int MAX_EVENTS = 16;
+	struct epoll_event events[MAX_EVENTS];
+	int timeout;
+	{
+		std::lock_guard<std::recursive_mutex> lock(handlers_lock_);
+		timeout = runTimers();
+	}
+	while (keepalive_) {
+		int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, timeout);
+		if (n < 0 && errno != EINTR) {
+			print_error("Reactor: epoll_wait failed: "
+					+ std::string(strerror(errno)));
+		}
+		std::lock_guard<std::recursive_mutex> lock(handlers_lock_);
+		for (int i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+			if (fd == wake_fd_) {
+				uint64_t count;
+				ssize_t bytes_read = read(wake_fd_, &count, sizeof(count));
+				(void) bytes_read;
+				continue;
+			}
+			// A handler earlier in this batch may have removed fd
+			std::map<int, UrReactorHandler*>::iterator it = handlers_.find(fd);
+			if (it != handlers_.end())
+				it->second->onEvent(fd, events[i].events);
+		}
+		timeout = runTimers();
+	}
+}
@@ -20,13 +20,12 @@
 
 UrRealtimeCommunication::UrRealtimeCommunication(
 		std::condition_variable& msg_cond, std::string host,
-		unsigned int safety_count_max) {
+		UrReactor* reactor, unsigned int safety_count_max) {
 	robot_state_ = new RobotStateRT(msg_cond);
+	reactor_ = reactor;
+	packet_log_ = NULL;
+	recorder_ = NULL;
 	bzero((char *) &serv_addr_, sizeof(serv_addr_));
-	sockfd_ = socket(AF_INET, SOCK_STREAM, 0);
-	if (sockfd_ < 0) {
-		print_fatal("ERROR opening socket");
-	}
 	server_ = gethostbyname(host.c_str());
 	if (server_ == NULL) {
 		print_fatal("ERROR, no such host");
@@ -34,15 +33,24 @@ UrRealtimeCommunication::UrRealtimeCommunication(
 	serv_addr_.sin_family = AF_INET;
 	bcopy((char *) server_->h_addr, (char *)&serv_addr_.sin_addr.s_addr, server_->h_length);
 	serv_addr_.sin_port = htons(30003);
+	openSocket();
+	connected_ = false;
+	connecting_ = false;
+	keepalive_ = false;
+	safety_count_ = safety_count_max + 1;
+	safety_count_max_ = safety_count_max;
+}
+
+void UrRealtimeCommunication::openSocket() {
+	sockfd_ = socket(AF_INET, SOCK_STREAM, 0);
+	if (sockfd_ < 0) {
+		print_fatal("ERROR opening socket");
+	}
 	flag_ = 1;
 	setsockopt(sockfd_, IPPROTO_TCP, TCP_NODELAY, (char *) &flag_, sizeof(int));
 	setsockopt(sockfd_, IPPROTO_TCP, TCP_QUICKACK, (char *) &flag_, sizeof(int));
 	setsockopt(sockfd_, SOL_SOCKET, SO_REUSEADDR, (char *) &flag_, sizeof(int));
 	fcntl(sockfd_, F_SETFL, O_NONBLOCK);
-	connected_ = false;
-	keepalive_ = false;
-	safety_count_ = safety_count_max + 1;
-	safety_count_max_ = safety_count_max;
 }
 
 bool UrRealtimeCommunication::start() {
@@ -50,6 +58,7 @@ bool UrRealtimeCommunication::start() {
 	struct timeval timeout;
 
 	keepalive_ = true;
+	robot_state_->selectLayout();
 	print_debug("Realtime port: Connecting...");
 
 	connect(sockfd_, (struct sockaddr *) &serv_addr_, sizeof(serv_addr_));
@@ -70,18 +79,34 @@ bool UrRealtimeCommunication::start() {
 	if (err < 0) {
 		print_fatal("Could not get local IP");
 		close(sockfd_);
+		sockfd_ = -1;
 		return false;
 	}
 	char str[18];
 	inet_ntop(AF_INET, &name.sin_addr, str, 18);
 	local_ip_ = str;
-	comThread_ = std::thread(&UrRealtimeCommunication::run, this);
+	print_debug("Realtime port: Got connection");
+	connected_ = true;
+	if (!reactor_->add(sockfd_, EPOLLIN | EPOLLRDHUP | EPOLLET, this)) {
+		connected_ = false;
+		close(sockfd_);
+		sockfd_ = -1;
+		return false;
+	}
 	return true;
 }
 
 void UrRealtimeCommunication::halt() {
 	keepalive_ = false;
-	comThread_.join();
+	reactor_->cancelTimers(this);
+	// disconnected() may have closed the socket already, its fd reused since
+	if (sockfd_ >= 0 && reactor_->remove(sockfd_, this)) {
+		if (connected_)
+			setSpeed(0., 0., 0., 0., 0., 0.);
+		close(sockfd_);
+		sockfd_ = -1;
+	}
+	connected_ = false;
 }
 
 void UrRealtimeCommunication::addCommandToQueue(std::string inp) {
@@ -114,85 +139,154 @@ void UrRealtimeCommunication::setSpeed(double q0, double q1, double q2,
 				q0, q1, q2, q3, q4, q5, acc);		
 	}
 	addCommandToQueue((std::string) (cmd));
+	if (recorder_ != NULL) {
+		double qd[6] = { q0, q1, q2, q3, q4, q5 };
+		recorder_->recordSpeed(qd, acc);
+	}
 	if (q0 != 0. or q1 != 0. or q2 != 0. or q3 != 0. or q4 != 0. or q5 != 0.) {
 		//If a joint speed is set, make sure we stop it again after some time if the user doesn't
 		safety_count_ = 0;
 	}
 }
 
-void UrRealtimeCommunication::run() {
-	uint8_t buf[2048];
+void UrRealtimeCommunication::onEvent(int, uint32_t events) {
+	if (connecting_) {
+		if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+			return;
+		int err = 0;
+		socklen_t err_len = sizeof(err);
+		getsockopt(sockfd_, SOL_SOCKET, SO_ERROR, &err, &err_len);
+		connecting_ = false;
+		if (err != 0) {
+			print_error("Error re-connecting to RT port 30003. Is controller started? Will try to reconnect in 10 seconds...");
+			reactor_->remove(sockfd_, this);
+			close(sockfd_);
+			sockfd_ = -1;
+			reactor_->callAfter(10., this,
+					std::bind(&UrRealtimeCommunication::reconnect, this));
+			return;
+		}
+		reactor_->modify(sockfd_, EPOLLIN | EPOLLRDHUP | EPOLLET);
+		connected_ = true;
+		print_info("Realtime port: Reconnected");
+		return;
+	}
+	// Edge triggered: read everything there is, even if the peer hung up
+	if (events & EPOLLIN)
+		readPackets();
+	if (connected_ && (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+		disconnected();
+}
+
+void UrRealtimeCommunication::readPackets() {
+	uint8_t * packet;
+	uint32_t packet_len;
 	int bytes_read;
-	bzero(buf, 2048);
-	struct timeval timeout;
-	fd_set readfds;
-	FD_ZERO(&readfds);
-	FD_SET(sockfd_, &readfds);
-	print_debug("Realtime port: Got connection");
-	connected_ = true;
-	while (keepalive_) {
-		while (connected_ && keepalive_) {
-			timeout.tv_sec = 0; //do this each loop as selects modifies timeout
-			timeout.tv_usec = 500000; // timeout of 0.5 sec
-			select(sockfd_ + 1, &readfds, NULL, NULL, &timeout);
-			bytes_read = read(sockfd_, buf, 2048);
-			if (bytes_read > 0) {
-				setsockopt(sockfd_, IPPROTO_TCP, TCP_QUICKACK, (char *) &flag_, 
-						sizeof(int));
-				robot_state_->unpack(buf);
+	while (connected_) {
+		// writePtr() may compact the buffer, so ask for the space afterwards
+		uint8_t * dst = framer_.writePtr();
+		bytes_read = read(sockfd_, dst, framer_.writeSpace());
+		if (bytes_read > 0) {
+			setsockopt(sockfd_, IPPROTO_TCP, TCP_QUICKACK, (char *) &flag_,
+					sizeof(int));
+			if (packet_log_ != NULL)
+				packet_log_->write(PACKET_LOG_REALTIME, dst, bytes_read);
+			framer_.commit(bytes_read);
+			// A read may hold part of a packet, or several of them
+			while (framer_.next(packet, packet_len)) {
+				robot_state_->unpack(packet);
 				if (safety_count_ == safety_count_max_) {
 					setSpeed(0., 0., 0., 0., 0., 0.);
 				}
 				safety_count_ += 1;
-			} else {
-				connected_ = false;
-				close(sockfd_);
 			}
-		}
-		if (keepalive_) {
-			//reconnect
-			print_warning("Realtime port: No connection. Is controller crashed? Will try to reconnect in 10 seconds...");
-			sockfd_ = socket(AF_INET, SOCK_STREAM, 0);
-			if (sockfd_ < 0) {
-				print_fatal("ERROR opening socket");
-			}
-			flag_ = 1;
-			setsockopt(sockfd_, IPPROTO_TCP, TCP_NODELAY, (char *) &flag_,
-					sizeof(int));
-			setsockopt(sockfd_, IPPROTO_TCP, TCP_QUICKACK, (char *) &flag_, 
-					sizeof(int));
-	
-			setsockopt(sockfd_, SOL_SOCKET, SO_REUSEADDR, (char *) &flag_,
-					sizeof(int));
-			fcntl(sockfd_, F_SETFL, O_NONBLOCK);
-			while (keepalive_ && !connected_) {
-				std::this_thread::sleep_for(std::chrono::seconds(10));
-				fd_set writefds;
-
-				connect(sockfd_, (struct sockaddr *) &serv_addr_,
-						sizeof(serv_addr_));
-				FD_ZERO(&writefds);
-				FD_SET(sockfd_, &writefds);
-				select(sockfd_ + 1, NULL, &writefds, NULL, NULL);
-				unsigned int flag_len;
-				getsockopt(sockfd_, SOL_SOCKET, SO_ERROR, &flag_, &flag_len);
-				if (flag_ < 0) {
-					print_error("Error re-connecting to RT port 30003. Is controller started? Will try to reconnect in 10 seconds...");
-				} else {
-					connected_ = true;
-					print_info("Realtime port: Reconnected");
-				}
+			if (framer_.failed()) {
+				print_error("Realtime port: Invalid packet length, reconnecting to find the packet boundaries again");
+				disconnected();
+				return;
 			}
+		} else if (bytes_read < 0 && errno == EINTR) {
+			continue;
+		} else if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return;
+		} else {
+			disconnected();
 		}
 	}
-	setSpeed(0., 0., 0., 0., 0., 0.);
+}
+
+void UrRealtimeCommunication::disconnected() {
+	connected_ = false;
+	framer_.reset();
+	reactor_->remove(sockfd_, this);
 	close(sockfd_);
+	sockfd_ = -1;
+	print_debug(
+			"Realtime port: Closed after "
+					+ std::to_string(framer_.getPackets())
+					+ " packets. Partial reads: "
+					+ std::to_string(framer_.getPartialReads())
+					+ ", coalesced reads: "
+					+ std::to_string(framer_.getCoalescedReads())
+					+ ", framing errors: "
+					+ std::to_string(framer_.getFramingErrors()));
+	if (keepalive_) {
+		print_warning("Realtime port: No connection. Is controller crashed? Will try to reconnect in 10 seconds...");
+		reactor_->callAfter(10., this,
+				std::bind(&UrRealtimeCommunication::reconnect, this));
+	}
+}
+
+void UrRealtimeCommunication::reconnect() {
+	if (!keepalive_)
+		return;
+	openSocket();
+	if (connect(sockfd_, (struct sockaddr *) &serv_addr_, sizeof(serv_addr_))
+			< 0 && errno != EINPROGRESS) {
+		print_error("Error re-connecting to RT port 30003. Is controller started? Will try to reconnect in 10 seconds...");
+		close(sockfd_);
+		sockfd_ = -1;
+		reactor_->callAfter(10., this,
+				std::bind(&UrRealtimeCommunication::reconnect, this));
+		return;
+	}
+	// Completion of the connect is reported as writability
+	connecting_ = true;
+	if (!reactor_->add(sockfd_, EPOLLOUT | EPOLLIN | EPOLLRDHUP | EPOLLET,
+			this)) {
+		connecting_ = false;
+		close(sockfd_);
+		sockfd_ = -1;
+		reactor_->callAfter(10., this,
+				std::bind(&UrRealtimeCommunication::reconnect, this));
+	}
 }
 
 void UrRealtimeCommunication::setSafetyCountMax(uint inp) {
 	safety_count_max_ = inp;
 }
 
+void UrRealtimeCommunication::setPacketLog(PacketLogWriter* log) {
+	packet_log_ = log;
+}
+
+void UrRealtimeCommunication::setFlightRecorder(FlightRecorder* recorder) {
+	recorder_ = recorder;
+	robot_state_->setFlightRecorder(recorder);
+}
+
 std::string UrRealtimeCommunication::getLocalIp() {
 	return local_ip_;
 }
+
+unsigned long UrRealtimeCommunication::getPartialReads() {
+	return framer_.getPartialReads();
+}
+
+unsigned long UrRealtimeCommunication::getCoalescedReads() {
+	return framer_.getCoalescedReads();
+}
+
+unsigned long UrRealtimeCommunication::getFramingErrors() {
+	return framer_.getFramingErrors();
+}
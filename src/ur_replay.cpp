@@ -0,0 +1,267 @@
+/*
+ * ur_replay.cpp
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays a packet log recorded with the ~packet_log parameter.
+ *
+ * Without --serve the records go through PacketFramer into
+ * RobotState::unpack and RobotStateRT::unpack, and the decode throughput
+ * is printed. With --serve the tool listens on ports 30001-30003 like a
+ * controller and sends the records to a ur_driver connecting to it, so
+ * its publishers see exactly the recorded data. URScript sent by the
+ * driver is discarded.
+ *
+ * --speed N replays N times faster than recorded, --max as fast as
+ * possible (the default without --serve).
+ *
+ * Usage: ur_replay <log> [--speed N | --max] [--loops N] [--serve [host]]
+ */
+
+#include "ur_modern_driver/packet_log.h"
+#include "ur_modern_driver/packet_framer.h"
+#include "ur_modern_driver/robot_state.h"
+#include "ur_modern_driver/robot_state_RT.h"
+#include "ur_modern_driver/do_output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <chrono>
+#include <thread>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+static void waitUntil(std::chrono::steady_clock::time_point t0,
+		uint64_t time_ns, double speed) {
+	if (speed <= 0.)
+		return;
+	std::this_thread::sleep_until(
+			t0 + std::chrono::nanoseconds((uint64_t) (time_ns / speed)));
+}
+
+static int decode(const std::vector<packet_log_record>& records, double speed,
+		unsigned long loops) {
+	std::condition_variable msg_cond, rt_msg_cond;
+	RobotState robot_state(msg_cond);
+	RobotStateRT robot_state_rt(rt_msg_cond);
+	PacketFramer sec_framer(8192), rt_framer;
+	uint8_t * packet;
+	uint32_t packet_len;
+	unsigned long sec_packets = 0, rt_packets = 0;
+	uint64_t bytes = 0;
+
+	// The firmware version decides the RT layout, like in UrDriver::start()
+	for (unsigned int i = 0; i < records.size(); i++) {
+		if (records[i].channel == PACKET_LOG_PRIMARY) {
+			std::vector<uint8_t> data = records[i].data;
+			robot_state.unpack(data.data(), data.size());
+		}
+	}
+	robot_state_rt.setVersion(robot_state.getVersion());
+	robot_state_rt.selectLayout();
+
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	for (unsigned long loop = 0; loop < loops; loop++) {
+		std::chrono::steady_clock::time_point loop_start =
+				std::chrono::steady_clock::now();
+		for (unsigned int i = 0; i < records.size(); i++) {
+			const packet_log_record& r = records[i];
+			PacketFramer* framer;
+			if (r.channel == PACKET_LOG_SECONDARY)
+				framer = &sec_framer;
+			else if (r.channel == PACKET_LOG_REALTIME)
+				framer = &rt_framer;
+			else
+				continue;
+			waitUntil(loop_start, r.time_ns, speed);
+			size_t offset = 0;
+			while (offset < r.data.size()) {
+				size_t n = std::min(framer->writeSpace(),
+						r.data.size() - offset);
+				memcpy(framer->writePtr(), &r.data[offset], n);
+				framer->commit(n);
+				offset += n;
+				while (framer->next(packet, packet_len)) {
+					if (r.channel == PACKET_LOG_SECONDARY) {
+						robot_state.unpack(packet, packet_len);
+						sec_packets += 1;
+					} else {
+						robot_state_rt.unpack(packet);
+						rt_packets += 1;
+					}
+				}
+				// The driver would reconnect here
+				if (framer->failed())
+					framer->reset();
+			}
+			bytes += r.data.size();
+		}
+	}
+	double elapsed = std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - t0).count();
+
+	printf("Replayed %lu x %lu records, firmware %.1f\n", loops,
+			(unsigned long) records.size(), robot_state.getVersion());
+	printf("  secondary packets: %lu, RT packets: %lu, %.1f MB in %.3f s\n",
+			sec_packets, rt_packets, bytes / 1e6, elapsed);
+	if (elapsed > 0. && sec_packets + rt_packets > 0)
+		printf("  %.0f packets/s, %.1f MB/s, %.1f ns/packet\n",
+				(sec_packets + rt_packets) / elapsed, bytes / 1e6 / elapsed,
+				elapsed * 1e9 / (sec_packets + rt_packets));
+	printf("  framing errors: secondary %lu, RT %lu\n",
+			sec_framer.getFramingErrors(), rt_framer.getFramingErrors());
+	return 0;
+}
+
+static int listenOn(const std::string& host, int port) {
+	struct sockaddr_in addr;
+	int flag = 1;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+			|| listen(fd, 1) < 0) {
+		print_fatal(
+				"Could not listen on " + host + ":" + std::to_string(port));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int acceptClient(int listen_fd) {
+	int flag = 1;
+	int fd = accept(listen_fd, NULL, NULL);
+	if (fd >= 0)
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+	return fd;
+}
+
+static int serve(const std::vector<packet_log_record>& records,
+		const std::string& host, double speed, unsigned long loops) {
+	int listen_fds[3];
+	for (int i = 0; i < 3; i++) {
+		listen_fds[i] = listenOn(host, 30001 + i);
+		if (listen_fds[i] < 0)
+			return 1;
+	}
+	print_info("Waiting for the driver on " + host);
+	// The driver reads the version from 30001 and then connects to 30002 and 30003
+	int pri_fd = acceptClient(listen_fds[0]);
+	for (unsigned int i = 0; i < records.size(); i++) {
+		if (records[i].channel == PACKET_LOG_PRIMARY)
+			send(pri_fd, records[i].data.data(), records[i].data.size(),
+					MSG_NOSIGNAL);
+	}
+	int sec_fd = acceptClient(listen_fds[1]);
+	int rt_fd = acceptClient(listen_fds[2]);
+	// Scripts sent on 30003 are read and dropped so the driver never blocks
+	std::thread drain([rt_fd] {
+		char buf[4096];
+		while (recv(rt_fd, buf, sizeof(buf), 0) > 0) {
+		}
+	});
+
+	unsigned long sent = 0;
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	for (unsigned long loop = 0; loop < loops; loop++) {
+		std::chrono::steady_clock::time_point loop_start =
+				std::chrono::steady_clock::now();
+		for (unsigned int i = 0; i < records.size(); i++) {
+			const packet_log_record& r = records[i];
+			int fd;
+			if (r.channel == PACKET_LOG_SECONDARY)
+				fd = sec_fd;
+			else if (r.channel == PACKET_LOG_REALTIME)
+				fd = rt_fd;
+			else
+				continue;
+			waitUntil(loop_start, r.time_ns, speed);
+			if (send(fd, r.data.data(), r.data.size(), MSG_NOSIGNAL) < 0) {
+				print_warning("The driver disconnected");
+				loop = loops;
+				break;
+			}
+			sent += 1;
+		}
+	}
+	printf("Sent %lu records in %.3f s\n", sent,
+			std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - t0).count());
+	shutdown(rt_fd, SHUT_RDWR);
+	drain.join();
+	close(pri_fd);
+	close(sec_fd);
+	close(rt_fd);
+	for (int i = 0; i < 3; i++)
+		close(listen_fds[i]);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	double speed = -1.; //not given
+	unsigned long loops = 1;
+	bool serve_log = false;
+	std::string host = "127.0.0.1";
+
+	if (argc < 2) {
+		fprintf(stderr,
+				"Usage: %s <log> [--speed N | --max] [--loops N] [--serve [host]]\n",
+				argv[0]);
+		return 1;
+	}
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+			speed = strtod(argv[++i], NULL);
+		} else if (strcmp(argv[i], "--max") == 0) {
+			speed = 0.;
+		} else if (strcmp(argv[i], "--loops") == 0 && i + 1 < argc) {
+			loops = strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--serve") == 0) {
+			serve_log = true;
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+				host = argv[++i];
+		} else {
+			fprintf(stderr, "Unknown argument %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (speed < 0.)
+		speed = serve_log ? 1. : 0.;
+	signal(SIGPIPE, SIG_IGN);
+
+	// Read up front, so the replay doesn't wait for the disk
+	PacketLogReader reader;
+	std::vector<packet_log_record> records;
+	packet_log_record record;
+	if (!reader.open(argv[1]))
+		return 1;
+	while (reader.next(record))
+		records.push_back(record);
+	reader.close();
+
+	if (serve_log)
+		return serve(records, host, speed, loops);
+	return decode(records, speed, loops);
+}
@@ -18,12 +18,14 @@
 
 #include "ur_modern_driver/ur_driver.h"
 #include "ur_modern_driver/ur_hardware_interface.h"
+#include "ur_modern_driver/rt_thread.h"
 #include "ur_modern_driver/do_output.h"
 #include <string.h>
 #include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <thread>
+#include <atomic>
 #include <algorithm>
 #include <cmath>
 #include <chrono>
@@ -48,18 +50,120 @@
 #include "ur_msgs/Digital.h"
 #include "ur_msgs/Analog.h"
 #include "std_msgs/String.h"
+#include "std_msgs/Float64MultiArray.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
 #include <controller_manager/controller_manager.h>
 #include <realtime_tools/realtime_publisher.h>
 
 /// TF
 #include <tf/tf.h>
-#include <tf/transform_broadcaster.h>
+#include <tf/tfMessage.h>
+
+/* Reads ~<ns>rt_priority, ~<ns>rt_cpu_affinity and ~<ns>lock_memory into config */
+void getRealtimeConfig(std::string ns, rt_thread_config& config) {
+	ros::param::get(ns + "rt_priority", config.priority);
+	ros::param::get(ns + "rt_cpu_affinity", config.cpus);
+	ros::param::get(ns + "lock_memory", config.lock_memory);
+}
+
+/*
+ * Decimates a topic to at most rate messages per second of the clock
+ * passed to due(). Messages are let through on a fixed grid, so 50 Hz out
+ * of a 125 Hz stream stays 50 Hz on average. rate <= 0 lets all through.
+ */
+class PublishRate {
+private:
+	double period_;
+	double next_;
+
+public:
+	PublishRate() :
+			period_(0.), next_(0.) {
+	}
+
+	void setRate(double rate) {
+		period_ = rate > 0. ? 1. / rate : 0.;
+		next_ = 0.;
+	}
+
+	bool due(double t) {
+		const double TOLERANCE = 1e-4; //controller times are sums of rounded periods
+		if (period_ <= 0.)
+			return true;
+		if (t < next_ - period_) //the clock restarted, e.g. a new controller
+			next_ = t;
+		if (t < next_ - TOLERANCE)
+			return false;
+		next_ += period_;
+		if (next_ <= t)
+			next_ = t + period_;
+		return true;
+	}
+};
+
+/* The pins and analog channels in which two io_states differ, as bitmasks */
+struct io_diff {
+	uint32_t digital_inputs;
+	uint32_t digital_outputs;
+	uint32_t analog_inputs; //bit 0 and 1
+	uint32_t analog_outputs;
+};
+
+/* Pins are limited to pin_mask, analog changes of up to deadband are ignored */
+io_diff diffIO(const io_state& io, const io_state& ref, uint32_t pin_mask,
+		double deadband) {
+	io_diff diff;
+	diff.digital_inputs = (io.digital_inputs ^ ref.digital_inputs) & pin_mask;
+	diff.digital_outputs = (io.digital_outputs ^ ref.digital_outputs) & pin_mask;
+	diff.analog_inputs = 0;
+	diff.analog_outputs = 0;
+	for (unsigned int i = 0; i < 2; i++) {
+		if (std::fabs(io.analog_inputs[i] - ref.analog_inputs[i]) > deadband)
+			diff.analog_inputs |= 1 << i;
+		if (std::fabs(io.analog_outputs[i] - ref.analog_outputs[i]) > deadband)
+			diff.analog_outputs |= 1 << i;
+	}
+	return diff;
+}
+
+bool anyIOChange(const io_diff& diff) {
+	return (diff.digital_inputs | diff.digital_outputs | diff.analog_inputs
+			| diff.analog_outputs) != 0;
+}
+
+/* Appends the pins set in mask with their state in bits */
+void appendDigital(std::vector<ur_msgs::Digital>& states, uint32_t mask,
+		uint32_t bits) {
+	ur_msgs::Digital digi;
+	while (mask != 0) {
+		digi.pin = __builtin_ctz(mask);
+		digi.state = (bits >> digi.pin) & 1;
+		states.push_back(digi);
+		mask &= mask - 1;
+	}
+}
+
+/* Appends the analog channels set in mask */
+void appendAnalog(std::vector<ur_msgs::Analog>& states, uint32_t mask,
+		const double* values) {
+	ur_msgs::Analog ana;
+	while (mask != 0) {
+		ana.pin = __builtin_ctz(mask);
+		ana.state = values[ana.pin];
+		states.push_back(ana);
+		mask &= mask - 1;
+	}
+}
 
 class RosWrapper {
 protected:
+	FlightRecorder flight_recorder_; //before robot_, so it outlives the threads recording into it
+	rt_snapshot_queue rt_queue_; //RT packets for the publisher or the ros_control thread, also before robot_
+	WakeSignal control_signal_; //wakes the ros_control thread
 	UrDriver robot_;
-	std::condition_variable rt_msg_cond_;
-	std::condition_variable msg_cond_;
+	std::condition_variable& rt_msg_cond_;
+	std::condition_variable& msg_cond_;
+	std::string param_ns_; //"~" or "~<robot name>/"
 	ros::NodeHandle nh_;
 	actionlib::ActionServer<control_msgs::FollowJointTrajectoryAction> as_;
 	actionlib::ServerGoalHandle<control_msgs::FollowJointTrajectoryAction> goal_handle_;
@@ -70,31 +174,77 @@ protected:
 	ros::Subscriber urscript_sub_;
 	ros::ServiceServer io_srv_;
 	ros::ServiceServer payload_srv_;
-	std::thread* rt_publish_thread_;
-	std::thread* mb_publish_thread_;
+	//Messages are allocated once and filled in place, see initRTPublishers()
+	boost::shared_ptr<realtime_tools::RealtimePublisher<sensor_msgs::JointState> > joint_pub_;
+	boost::shared_ptr<realtime_tools::RealtimePublisher<geometry_msgs::WrenchStamped> > wrench_pub_;
+	boost::shared_ptr<realtime_tools::RealtimePublisher<geometry_msgs::TwistStamped> > tool_vel_pub_;
+	boost::shared_ptr<realtime_tools::RealtimePublisher<tf::tfMessage> > tf_pub_;
+	ros::Publisher io_pub_;
+	ros::Publisher io_event_pub_;
+	ros::Publisher diagnostics_pub_;
+	std::string host_;
+	ros::Publisher latency_pub_;
+	uint64_t next_sequence_;
+	bool rt_consumer_started_; //rt_queue_ was emptied of what piled up before the consumer ran
+	unsigned long startup_overruns_; //overruns of rt_queue_ before that
+	uint64_t skipped_packets_; //lost because rt_queue_ was full
+	uint64_t coalesced_packets_; //queued while the consumer was busy, only the newest was used
+	PublishRate joint_states_rate_;
+	PublishRate wrench_rate_;
+	PublishRate tool_velocity_rate_;
+	PublishRate tf_rate_;
+	PublishRate io_states_rate_;
+	PublishRate diagnostics_rate_;
+	bool io_states_on_change_;
+	double io_analog_deadband_;
+	bool io_published_;
+	io_state last_io_; //as last published on io_states
+	bool io_events_started_;
+	io_state event_io_; //as last reported on io_events
+	ur_msgs::IOStates io_msg_; //filled in place, see publishIOStates()
+	ur_msgs::IOStates io_event_msg_;
+	bool warned_;
+	bool started_;
 	double io_flag_delay_;
 	double max_velocity_;
+	bool use_accelerations_;
 	std::vector<double> joint_offsets_;
     std::string base_frame_;
     std::string tool_frame_;
 	bool use_ros_control_;
+	rt_thread_config rt_config_;
+	PacketLogWriter packet_log_;
 	std::thread* ros_control_thread_;
 	boost::shared_ptr<ros_control_ur::UrHardwareInterface> hardware_interface_;
 	boost::shared_ptr<controller_manager::ControllerManager> controller_manager_;
 
 public:
-	RosWrapper(std::string host, int reverse_port) :
-			as_(nh_, "follow_joint_trajectory",
+	/*
+	 * name is empty for a single robot, which keeps its parameters in the
+	 * private namespace of the node and its topics in the node's namespace.
+	 * A named robot reads ~<name>/... and publishes under <name>/.
+	 */
+	RosWrapper(std::string host, int reverse_port,
+			std::condition_variable& rt_msg_cond,
+			std::condition_variable& msg_cond, WakeSignal* rt_signal,
+			UrReactor* reactor, std::string name = "") :
+			robot_(rt_msg_cond, msg_cond, host, reverse_port, 0.03, 300, 0.08,
+					0., 1., 0.03, 300., reactor), rt_msg_cond_(rt_msg_cond), msg_cond_(
+					msg_cond), param_ns_(name.empty() ? "~" : "~" + name + "/"), nh_(
+					name), as_(nh_, "follow_joint_trajectory",
 					boost::bind(&RosWrapper::goalCB, this, _1),
-					boost::bind(&RosWrapper::cancelCB, this, _1), false), robot_(
-					rt_msg_cond_, msg_cond_, host, reverse_port, 0.03, 300), io_flag_delay_(0.05), joint_offsets_(
-					6, 0.0) {
+					boost::bind(&RosWrapper::cancelCB, this, _1), false), next_sequence_(
+					0), rt_consumer_started_(false), startup_overruns_(0), skipped_packets_(
+					0), coalesced_packets_(0), io_states_on_change_(
+					false), io_analog_deadband_(0.), io_published_(false), io_events_started_(
+					false), warned_(false), started_(false), io_flag_delay_(
+					0.05), joint_offsets_(6, 0.0) {
 
 		std::string joint_prefix = "";
 		std::vector<std::string> joint_names;
 		char buf[256];
 
-		if (ros::param::get("~prefix", joint_prefix)) {
+		if (getParam("prefix", joint_prefix)) {
 		    if (joint_prefix.length() > 0) {
     			sprintf(buf, "Setting prefix to %s", joint_prefix.c_str());
 	    		print_info(buf);
@@ -109,7 +259,16 @@ public:
 		robot_.setJointNames(joint_names);
 
 		use_ros_control_ = false;
-		ros::param::get("~use_ros_control", use_ros_control_);
+		getParam("use_ros_control", use_ros_control_);
+
+		//Every RT packet is queued for whichever thread consumes them, the
+		//publishers of all robots share rt_signal
+		rt_queue_.setSignal(use_ros_control_ ? &control_signal_ : rt_signal);
+		robot_.rt_interface_->robot_state_->addConsumer(&rt_queue_);
+
+		//A robot without its own scheduling settings uses those of the node
+		getRealtimeConfig("~", rt_config_);
+		getRealtimeConfig(param_ns_, rt_config_);
 
 		if (use_ros_control_) {
 			hardware_interface_.reset(
@@ -118,7 +277,7 @@ public:
 					new controller_manager::ControllerManager(
 							hardware_interface_.get(), nh_));
 			double max_vel_change = 0.12; // equivalent of an acceleration of 15 rad/sec^2
-			if (ros::param::get("~max_acceleration", max_vel_change)) {
+			if (getParam("max_acceleration", max_vel_change)) {
 				max_vel_change = max_vel_change / 125;
 			}
 			sprintf(buf, "Max acceleration set to: %f [rad/sec²]",
@@ -128,21 +287,104 @@ public:
 		}
 		//Using a very high value in order to not limit execution of trajectories being sent from MoveIt!
 		max_velocity_ = 10.;
-		if (ros::param::get("~max_velocity", max_velocity_)) {
+		if (getParam("max_velocity", max_velocity_)) {
 			sprintf(buf, "Max velocity accepted by ur_driver: %f [rad/s]",
 					max_velocity_);
 			print_debug(buf);
 		}
 
+		//Goals that have accelerations for every point are interpolated with
+		//quintic splines unless interpolation is set to "cubic"
+		std::string interpolation = "auto";
+		getParam("interpolation", interpolation);
+		if (interpolation != "auto" and interpolation != "cubic") {
+			print_warning(
+					"Unknown interpolation '" + interpolation
+							+ "'. Use 'auto' or 'cubic'. Using 'auto'");
+			interpolation = "auto";
+		}
+		use_accelerations_ = (interpolation == "auto");
+		print_debug("Trajectory interpolation: " + interpolation);
+
+		//"stream" sends every setpoint when it is due, "buffered" keeps a
+		//buffer of setpoints on the robot filled ahead of time
+		std::string trajectory_mode = "stream";
+		getParam("trajectory_mode", trajectory_mode);
+		if (trajectory_mode != "stream" and trajectory_mode != "buffered") {
+			print_warning(
+					"Unknown trajectory_mode '" + trajectory_mode
+							+ "'. Use 'stream' or 'buffered'. Using 'stream'");
+			trajectory_mode = "stream";
+		}
+		robot_.setBufferedTrajectory(trajectory_mode == "buffered");
+		print_debug("Trajectory mode: " + trajectory_mode);
+
+		//Leave driverProg() running between goals of the stream mode, so the
+		//next trajectory doesn't have to upload it and wait for the robot
+		bool keep_reverse_connection = true;
+		getParam("keep_reverse_connection", keep_reverse_connection);
+		robot_.setKeepReverseConnection(keep_reverse_connection);
+
+		//Maximum publishing rates in Hz, 0 publishes every packet. The
+		//RT topics follow the controller clock, io_states the host clock
+		double rate = 0.;
+		if (getParam("joint_states_rate", rate))
+			joint_states_rate_.setRate(rate);
+		rate = 0.;
+		if (getParam("wrench_rate", rate))
+			wrench_rate_.setRate(rate);
+		rate = 0.;
+		if (getParam("tool_velocity_rate", rate))
+			tool_velocity_rate_.setRate(rate);
+		rate = 0.;
+		if (getParam("tf_rate", rate))
+			tf_rate_.setRate(rate);
+		rate = 0.;
+		if (getParam("io_states_rate", rate))
+			io_states_rate_.setRate(rate);
+		rate = 1.;
+		getParam("diagnostics_rate", rate);
+		diagnostics_rate_.setRate(rate);
+		host_ = host;
+		//Only publish io_states when an input or output changed. The topic is
+		//latched then, so new subscribers still get the current state
+		getParam("io_states_on_change", io_states_on_change_);
+		//Analog changes smaller than this are no change for io_events and
+		//io_states_on_change, so noise doesn't flood the topics
+		getParam("io_analog_deadband", io_analog_deadband_);
+		//Room for every pin, so the messages never grow while publishing
+		io_event_msg_.digital_in_states.reserve(32);
+		io_event_msg_.digital_out_states.reserve(32);
+		io_event_msg_.analog_in_states.reserve(2);
+		io_event_msg_.analog_out_states.reserve(2);
+
+		//Raw bytes from the robot, for replaying them with ur_replay
+		std::string packet_log;
+		if (getParam("packet_log", packet_log) && !packet_log.empty()
+				&& packet_log_.open(packet_log))
+			robot_.setPacketLog(&packet_log_);
+
+		//Ring of the last RT packets and setpoints, dumped on a stop.
+		//An empty path turns it off
+		std::string flight_recorder = "/tmp/ur_flight_recorder_" + host
+				+ ".bin";
+		int flight_recorder_records = 30000; //a minute at 500 Hz
+		getParam("flight_recorder", flight_recorder);
+		getParam("flight_recorder_records", flight_recorder_records);
+		if (!flight_recorder.empty() && flight_recorder_records > 0
+				&& flight_recorder_.open(flight_recorder,
+						flight_recorder_records))
+			robot_.setFlightRecorder(&flight_recorder_);
+
 		//Bounds for SetPayload service
 		//Using a very conservative value as it should be set through the parameter server
 		double min_payload = 0.;
 		double max_payload = 1.;
-		if (ros::param::get("~min_payload", min_payload)) {
+		if (getParam("min_payload", min_payload)) {
 			sprintf(buf, "Min payload set to: %f [kg]", min_payload);
 			print_debug(buf);
 		}
-		if (ros::param::get("~max_payload", max_payload)) {
+		if (getParam("max_payload", max_payload)) {
 			sprintf(buf, "Max payload set to: %f [kg]", max_payload);
 			print_debug(buf);
 		}
@@ -153,21 +395,21 @@ public:
 		print_debug(buf);
 
 		double servoj_time = 0.008;
-		if (ros::param::get("~servoj_time", servoj_time)) {
+		if (getParam("servoj_time", servoj_time)) {
 			sprintf(buf, "Servoj_time set to: %f [sec]", servoj_time);
 			print_debug(buf);
 		}
 		robot_.setServojTime(servoj_time);
 
 		double servoj_lookahead_time = 0.03;
-		if (ros::param::get("~servoj_lookahead_time", servoj_lookahead_time)) {
+		if (getParam("servoj_lookahead_time", servoj_lookahead_time)) {
 			sprintf(buf, "Servoj_lookahead_time set to: %f [sec]", servoj_lookahead_time);
 			print_debug(buf);
 		}
 		robot_.setServojLookahead(servoj_lookahead_time);
 
 		double servoj_gain = 300.;
-		if (ros::param::get("~servoj_gain", servoj_gain)) {
+		if (getParam("servoj_gain", servoj_gain)) {
 			sprintf(buf, "Servoj_gain set to: %f [sec]", servoj_gain);
 			print_debug(buf);
 		}
@@ -176,16 +418,17 @@ public:
         //Base and tool frames
         base_frame_ = joint_prefix + "base_link";
         tool_frame_ =  joint_prefix + "tool0_controller";
-        if (ros::param::get("~base_frame", base_frame_)) {
+        if (getParam("base_frame", base_frame_)) {
             sprintf(buf, "Base frame set to: %s", base_frame_.c_str());
             print_debug(buf);
         }
-        if (ros::param::get("~tool_frame", tool_frame_)) {
+        if (getParam("tool_frame", tool_frame_)) {
             sprintf(buf, "Tool frame set to: %s", tool_frame_.c_str());
             print_debug(buf);
         }
 
 		if (robot_.start()) {
+			started_ = true;
 			if (use_ros_control_) {
 				ros_control_thread_ = new std::thread(
 						boost::bind(&RosWrapper::rosControlLoop, this));
@@ -196,14 +439,21 @@ public:
 				has_goal_ = false;
 				as_.start();
 
-				//subscribe to the data topic of interest
-				rt_publish_thread_ = new std::thread(
-						boost::bind(&RosWrapper::publishRTMsg, this));
+				//RT data is published by the shared PublisherPool
+				initRTPublishers();
+				latency_pub_ = nh_.advertise<std_msgs::Float64MultiArray>(
+						"ur_driver/trajectory_start_latency", 1, true);
 				print_debug(
 						"The action server for this driver has been started");
 			}
-			mb_publish_thread_ = new std::thread(
-					boost::bind(&RosWrapper::publishMbMsg, this));
+			io_pub_ = nh_.advertise<ur_msgs::IOStates>("ur_driver/io_states",
+					1, io_states_on_change_);
+			//Only the pins and channels that changed since the last packet
+			io_event_pub_ = nh_.advertise<ur_msgs::IOStates>(
+					"ur_driver/io_events", 16);
+			//Decoded secondary interface packages, see publishDiagnostics()
+			diagnostics_pub_ = nh_.advertise<diagnostic_msgs::DiagnosticArray>(
+					"/diagnostics", 1);
 			speed_sub_ = nh_.subscribe("ur_driver/joint_speed", 1,
 					&RosWrapper::speedInterface, this);
 			urscript_sub_ = nh_.subscribe("ur_driver/URScript", 1,
@@ -218,18 +468,504 @@ public:
 
 	void halt() {
 		robot_.halt();
-		rt_publish_thread_->join();
+		packet_log_.close();
+		print_debug(
+				"RT queue: " + std::to_string(rt_queue_.getPushed())
+						+ " packets queued, "
+						+ std::to_string(
+								rt_queue_.getOverruns() - startup_overruns_)
+						+ " dropped by overruns, "
+						+ std::to_string(coalesced_packets_)
+						+ " skipped for a newer one");
+	}
+
+	bool hasRTData() {
+		return started_ && !use_ros_control_ && !rt_queue_.empty();
+	}
 
+	bool hasMbData() {
+		return started_
+				&& robot_.sec_interface_->robot_state_->getNewDataAvailable();
 	}
+
+	void publishRTMsg() {
+		robot_state_rt_data state;
+		// Everything published in this cycle comes from the same controller packet
+		if (!popRTState(state))
+			return;
+		ros::Time stamp = ros::Time::now();
+
+		// A publisher still sending the previous message drops this one
+		if (joint_states_rate_.due(state.time) and joint_pub_->trylock()) {
+			sensor_msgs::JointState& joint_msg = joint_pub_->msg_;
+			joint_msg.header.stamp = stamp;
+			for (unsigned int i = 0; i < 6; i++) {
+				joint_msg.position[i] = state.q_actual[i] + joint_offsets_[i];
+				joint_msg.velocity[i] = state.qd_actual[i];
+				joint_msg.effort[i] = state.i_actual[i];
+			}
+			joint_pub_->unlockAndPublish();
+		}
+
+		if (wrench_rate_.due(state.time) and wrench_pub_->trylock()) {
+			const std::array<double, 6>& tcp_force = state.tcp_force;
+			geometry_msgs::Wrench& wrench = wrench_pub_->msg_.wrench;
+			wrench_pub_->msg_.header.stamp = stamp;
+			wrench.force.x = tcp_force[0];
+			wrench.force.y = tcp_force[1];
+			wrench.force.z = tcp_force[2];
+			wrench.torque.x = tcp_force[3];
+			wrench.torque.y = tcp_force[4];
+			wrench.torque.z = tcp_force[5];
+			wrench_pub_->unlockAndPublish();
+		}
+
+		// Tool vector: Actual Cartesian coordinates of the tool: (x,y,z,rx,ry,rz), where rx, ry and rz is a rotation vector representation of the tool orientation
+		if (tf_rate_.due(state.time) and tf_pub_->trylock()) {
+			const std::array<double, 6>& tool_vector_actual = state.tool_vector_actual;
+			geometry_msgs::TransformStamped& transform = tf_pub_->msg_.transforms[0];
+			double rx = tool_vector_actual[3];
+			double ry = tool_vector_actual[4];
+			double rz = tool_vector_actual[5];
+			double angle = std::sqrt(std::pow(rx,2) + std::pow(ry,2) + std::pow(rz,2));
+			transform.header.stamp = stamp;
+			if (angle < 1e-16) {
+				transform.transform.rotation.x = 0;
+				transform.transform.rotation.y = 0;
+				transform.transform.rotation.z = 0;
+				transform.transform.rotation.w = 1;
+			} else {
+				transform.transform.rotation.x = (rx/angle) * std::sin(angle*0.5);
+				transform.transform.rotation.y = (ry/angle) * std::sin(angle*0.5);
+				transform.transform.rotation.z = (rz/angle) * std::sin(angle*0.5);
+				transform.transform.rotation.w = std::cos(angle*0.5);
+			}
+			transform.transform.translation.x = tool_vector_actual[0];
+			transform.transform.translation.y = tool_vector_actual[1];
+			transform.transform.translation.z = tool_vector_actual[2];
+			tf_pub_->unlockAndPublish();
+		}
+
+		//Publish tool velocity
+		if (tool_velocity_rate_.due(state.time) and tool_vel_pub_->trylock()) {
+			const std::array<double, 6>& tcp_speed = state.tcp_speed_actual;
+			geometry_msgs::Twist& twist = tool_vel_pub_->msg_.twist;
+			tool_vel_pub_->msg_.header.stamp = stamp;
+			twist.linear.x = tcp_speed[0];
+			twist.linear.y = tcp_speed[1];
+			twist.linear.z = tcp_speed[2];
+			twist.angular.x = tcp_speed[3];
+			twist.angular.y = tcp_speed[4];
+			twist.angular.z = tcp_speed[5];
+			tool_vel_pub_->unlockAndPublish();
+		}
+	}
+
+	void publishMbMsg() {
+		io_state io;
+		RobotModeView mode;
+		robot_.sec_interface_->robot_state_->getIOState(io);
+		publishIOEvents(io);
+		if (ioStatesDue(io))
+			publishIOStates(io);
+		if (diagnostics_rate_.due(
+				std::chrono::duration<double>(
+						std::chrono::steady_clock::now().time_since_epoch()).count()))
+			publishDiagnostics();
+
+		// One view, so both flags come from the same packet
+		mode = robot_.sec_interface_->robot_state_->getRobotModeView();
+		if (mode.isEmergencyStopped() or mode.isProtectiveStopped()) {
+			if (mode.isEmergencyStopped() and !warned_) {
+				print_error("Emergency stop pressed!");
+			} else if (mode.isProtectiveStopped() and !warned_) {
+				print_error("Robot is protective stopped!");
+			}
+			if (!warned_ and flight_recorder_.isOpen())
+				flight_recorder_.dump();
+			if (has_goal_) {
+				print_error("Aborting trajectory");
+				robot_.stopTraj();
+				result_.error_code = result_.SUCCESSFUL;
+				result_.error_string = "Robot was halted";
+				goal_handle_.setAborted(result_, result_.error_string);
+				has_goal_ = false;
+			}
+			warned_ = true;
+		} else
+			warned_ = false;
+
+		robot_.sec_interface_->robot_state_->finishedReading();
+	}
+
 private:
-	void trajThread(std::vector<double> timestamps,
-			std::vector<std::vector<double> > positions,
-			std::vector<std::vector<double> > velocities) {
+	static void addValue(diagnostic_msgs::DiagnosticStatus& status,
+			const std::string& key, double value) {
+		diagnostic_msgs::KeyValue kv;
+		kv.key = key;
+		kv.value = std::to_string(value);
+		status.values.push_back(kv);
+	}
+
+	/* One value per name, keyed "<name> <key>" */
+	template<typename T>
+	static void addValues(diagnostic_msgs::DiagnosticStatus& status,
+			const std::vector<std::string>& names, const std::string& key,
+			const T* values) {
+		for (unsigned int i = 0; i < names.size(); i++)
+			addValue(status, names[i] + " " + key, values[i]);
+	}
+
+	void addStatus(diagnostic_msgs::DiagnosticArray& msg,
+			diagnostic_msgs::DiagnosticStatus& status, const std::string& name) {
+		status.name = nh_.resolveName("ur_driver") + ": " + name;
+		msg.status.push_back(status);
+		status.values.clear();
+	}
+
+	/*
+	 * Everything decoded from the secondary interface, one status per
+	 * package plus the controller. Packages the controller hasn't sent are
+	 * left out.
+	 */
+	void publishDiagnostics() {
+		static const std::string axes[] = { "x", "y", "z", "rx", "ry", "rz" };
+		const std::vector<std::string> pose_names(axes, axes + 6);
+		secondary_state_data sec;
+		RobotState* state = robot_.sec_interface_->robot_state_;
+		diagnostic_msgs::DiagnosticArray msg;
+		diagnostic_msgs::DiagnosticStatus status;
+		std::vector<std::string> joint_names = robot_.getJointNames();
+		MasterboardView mb = state->getMasterboardView();
+		RobotModeView mode = state->getRobotModeView();
+		state->snapshot(sec);
+		msg.header.stamp = ros::Time::now();
+		status.hardware_id = host_;
+		status.level = diagnostic_msgs::DiagnosticStatus::OK;
+
+		if (sec.received & (1 << packageType::JOINT_DATA)) {
+			const joint_data& d = sec.joints;
+			addValues(status, joint_names, "position", d.qActual);
+			addValues(status, joint_names, "target position", d.qTarget);
+			addValues(status, joint_names, "velocity", d.qdActual);
+			addValues(status, joint_names, "current", d.iActual);
+			addValues(status, joint_names, "voltage", d.vActual);
+			addValues(status, joint_names, "motor temperature", d.tMotor);
+			addValues(status, joint_names, "micro temperature", d.tMicro);
+			addValues(status, joint_names, "mode", d.jointMode);
+			addStatus(msg, status, "Joints");
+		}
+
+		if (sec.received & (1 << packageType::TOOL_DATA)) {
+			const tool_data& d = sec.tool;
+			addValue(status, "Analog input range 2", d.analogInputRange2);
+			addValue(status, "Analog input range 3", d.analogInputRange3);
+			addValue(status, "Analog input 2", d.analogInput2);
+			addValue(status, "Analog input 3", d.analogInput3);
+			addValue(status, "Voltage 48V", d.toolVoltage48V);
+			addValue(status, "Output voltage", d.toolOutputVoltage);
+			addValue(status, "Current", d.toolCurrent);
+			addValue(status, "Temperature", d.toolTemperature);
+			addValue(status, "Mode", d.toolMode);
+			addStatus(msg, status, "Tool");
+		}
 
-		robot_.doTraj(timestamps, positions, velocities);
+		if (sec.received & (1 << packageType::CARTESIAN_INFO)) {
+			addValues(status, pose_names, "TCP", sec.cartesian.pose);
+			addValues(status, pose_names, "TCP offset", sec.cartesian.tcpOffset);
+			addStatus(msg, status, "Cartesian");
+		}
+
+		if (sec.received & (1 << packageType::KINEMATICS_INFO)) {
+			const kinematics_info& d = sec.kinematics;
+			addValues(status, joint_names, "checksum", d.checksum);
+			addValues(status, joint_names, "DH theta", d.dhTheta);
+			addValues(status, joint_names, "DH a", d.dhA);
+			addValues(status, joint_names, "DH d", d.dhD);
+			addValues(status, joint_names, "DH alpha", d.dhAlpha);
+			addValue(status, "Calibration status", d.calibrationStatus);
+			addStatus(msg, status, "Kinematics");
+		}
+
+		if (sec.received & (1 << packageType::CONFIGURATION_DATA)) {
+			const configuration_data& d = sec.configuration;
+			addValues(status, joint_names, "min limit", d.jointMinLimit);
+			addValues(status, joint_names, "max limit", d.jointMaxLimit);
+			addValues(status, joint_names, "max speed", d.jointMaxSpeed);
+			addValues(status, joint_names, "max acceleration",
+					d.jointMaxAcceleration);
+			addValue(status, "Default joint speed", d.vJointDefault);
+			addValue(status, "Default joint acceleration", d.aJointDefault);
+			addValue(status, "Default tool speed", d.vToolDefault);
+			addValue(status, "Default tool acceleration", d.aToolDefault);
+			addValue(status, "Eq radius", d.eqRadius);
+			addValues(status, joint_names, "DH a", d.dhA);
+			addValues(status, joint_names, "DH d", d.dhD);
+			addValues(status, joint_names, "DH alpha", d.dhAlpha);
+			addValues(status, joint_names, "DH theta", d.dhTheta);
+			addValue(status, "Masterboard version", d.masterboardVersion);
+			addValue(status, "Controller box type", d.controllerBoxType);
+			addValue(status, "Robot type", d.robotType);
+			addValue(status, "Robot sub type", d.robotSubType);
+			addStatus(msg, status, "Configuration");
+		}
+
+		if (sec.received & (1 << packageType::FORCE_MODE_DATA)) {
+			addValues(status, pose_names, "frame", sec.forceMode.frame);
+			addValue(status, "Robot dexterity", sec.forceMode.robotDexterity);
+			addStatus(msg, status, "Force mode");
+		}
+
+		if (sec.received & (1 << packageType::CALIBRATION_DATA)) {
+			static const std::string forces[] = { "Fx", "Fy", "Fz", "Frx", "Fry",
+					"Frz" };
+			addValues(status, std::vector<std::string>(forces, forces + 6),
+					"calibration", sec.calibration.force);
+			addStatus(msg, status, "Calibration");
+		}
+
+		if (sec.received & (1 << packageType::ADDITIONAL_INFO)) {
+			addValue(status, "Freedrive button pressed",
+					sec.additional.freedriveButtonPressed);
+			addValue(status, "Freedrive button enabled",
+					sec.additional.freedriveButtonEnabled);
+			addValue(status, "IO enabled freedrive",
+					sec.additional.ioEnabledFreedrive);
+			addStatus(msg, status, "Additional info");
+		}
+
+		addValue(status, "Firmware version", state->getVersion());
+		addValue(status, "Robot mode", mode.robotMode());
+		addValue(status, "Control mode", mode.controlMode());
+		addValue(status, "Speed scaling", mode.speedScaling());
+		addValue(status, "Safety mode", mb.safetyMode());
+		addValue(status, "Masterboard temperature",
+				mb.masterBoardTemperature());
+		addValue(status, "Robot voltage 48V", mb.robotVoltage48V());
+		addValue(status, "Robot current", mb.robotCurrent());
+		addValue(status, "IO current", mb.masterIOCurrent());
+		addValue(status, "Decode errors", state->getDecodeErrors());
+		if (mode.isEmergencyStopped()) {
+			status.level = diagnostic_msgs::DiagnosticStatus::ERROR;
+			status.message = "Emergency stopped";
+		} else if (mode.isProtectiveStopped()) {
+			status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+			status.message = "Protective stopped";
+		}
+		addStatus(msg, status, "Controller");
+		diagnostics_pub_.publish(msg);
+	}
+
+	/* Digital pins of the connected controller */
+	uint32_t ioPinMask() {
+		if (robot_.sec_interface_->robot_state_->getVersion() > 3.0)
+			return (1 << 18) - 1; // From version 3.0, there are up to 18 inputs and outputs
+		return (1 << 10) - 1;
+	}
+
+	/*
+	 * Applies io_states_rate and io_states_on_change. A change held back
+	 * by the rate is published once the rate allows, as it still differs
+	 * from the last published state then.
+	 */
+	bool ioStatesDue(const io_state& io) {
+		if (io_states_on_change_ and io_published_
+				and !anyIOChange(
+						diffIO(io, last_io_, ioPinMask(), io_analog_deadband_)))
+			return false;
+		if (!io_states_rate_.due(
+				std::chrono::duration<double>(
+						std::chrono::steady_clock::now().time_since_epoch()).count()))
+			return false;
+		last_io_ = io;
+		io_published_ = true;
+		return true;
+	}
+
+	void publishIOStates(const io_state& io) {
+		uint32_t pins = ioPinMask();
+		unsigned int n = __builtin_popcount(pins);
+		if (io_msg_.digital_in_states.size() != n) {
+			io_msg_.digital_in_states.resize(n);
+			io_msg_.digital_out_states.resize(n);
+			io_msg_.analog_in_states.resize(2);
+			io_msg_.analog_out_states.resize(2);
+			for (unsigned int i = 0; i < n; i++) {
+				io_msg_.digital_in_states[i].pin = i;
+				io_msg_.digital_out_states[i].pin = i;
+			}
+			for (unsigned int i = 0; i < 2; i++) {
+				io_msg_.analog_in_states[i].pin = i;
+				io_msg_.analog_out_states[i].pin = i;
+			}
+		}
+		for (unsigned int i = 0; i < n; i++) {
+			io_msg_.digital_in_states[i].state = (io.digital_inputs >> i) & 1;
+			io_msg_.digital_out_states[i].state = (io.digital_outputs >> i) & 1;
+		}
+		for (unsigned int i = 0; i < 2; i++) {
+			io_msg_.analog_in_states[i].state = io.analog_inputs[i];
+			io_msg_.analog_out_states[i].state = io.analog_outputs[i];
+		}
+		io_pub_.publish(io_msg_);
+	}
+
+	/*
+	 * Publishes the pins and analog channels that changed on io_events.
+	 * The first packet is only the reference for the next one.
+	 */
+	void publishIOEvents(const io_state& io) {
+		if (!io_events_started_) {
+			event_io_ = io;
+			io_events_started_ = true;
+			return;
+		}
+		io_diff diff = diffIO(io, event_io_, ioPinMask(), io_analog_deadband_);
+		if (!anyIOChange(diff))
+			return;
+		io_event_msg_.digital_in_states.clear();
+		io_event_msg_.digital_out_states.clear();
+		io_event_msg_.analog_in_states.clear();
+		io_event_msg_.analog_out_states.clear();
+		appendDigital(io_event_msg_.digital_in_states, diff.digital_inputs,
+				io.digital_inputs);
+		appendDigital(io_event_msg_.digital_out_states, diff.digital_outputs,
+				io.digital_outputs);
+		appendAnalog(io_event_msg_.analog_in_states, diff.analog_inputs,
+				io.analog_inputs);
+		appendAnalog(io_event_msg_.analog_out_states, diff.analog_outputs,
+				io.analog_outputs);
+		// Analog values are only taken over when reported, so a slow drift
+		// is reported once it adds up to more than the deadband
+		event_io_.digital_inputs = io.digital_inputs;
+		event_io_.digital_outputs = io.digital_outputs;
+		for (unsigned int i = 0; i < 2; i++) {
+			if (diff.analog_inputs & (1 << i))
+				event_io_.analog_inputs[i] = io.analog_inputs[i];
+			if (diff.analog_outputs & (1 << i))
+				event_io_.analog_outputs[i] = io.analog_outputs[i];
+		}
+		io_event_pub_.publish(io_event_msg_);
+	}
+
+	template<typename T>
+	bool getParam(const std::string& name, T& value) {
+		return ros::param::get(param_ns_ + name, value);
+	}
+
+	/*
+	 * Empties rt_queue_ into state, so state is the newest packet. Returns
+	 * false if nothing was queued. Sequence gaps are packets the full queue
+	 * had to drop.
+	 *
+	 * The queue fills up from the first RT packet on, before anything
+	 * consumes it, and then keeps its oldest packets. The first call
+	 * therefore throws all of them away and waits for the next packet.
+	 */
+	bool popRTState(robot_state_rt_data& state) {
+		unsigned int popped = 0;
+		if (!rt_consumer_started_) {
+			while (rt_queue_.pop(state)) {
+			}
+			startup_overruns_ = rt_queue_.getOverruns();
+			rt_consumer_started_ = true;
+			return false;
+		}
+		while (rt_queue_.pop(state)) {
+			if (next_sequence_ != 0 and state.sequence > next_sequence_) {
+				skipped_packets_ += state.sequence - next_sequence_;
+				print_debug(
+						"RT queue overrun: Lost "
+								+ std::to_string(state.sequence - next_sequence_)
+								+ " packet(s) before controller time "
+								+ std::to_string(state.time) + " ("
+								+ std::to_string(skipped_packets_)
+								+ " in total)");
+			}
+			next_sequence_ = state.sequence + 1;
+			popped += 1;
+		}
+		if (popped > 1)
+			coalesced_packets_ += popped - 1;
+		return popped > 0;
+	}
+
+	/*
+	 * The messages of publishRTMsg() get their names, frames and array
+	 * sizes here, so publishing only overwrites numbers and never allocates
+	 */
+	void initRTPublishers() {
+		joint_pub_.reset(
+				new realtime_tools::RealtimePublisher<sensor_msgs::JointState>(
+						nh_, "joint_states", 1));
+		wrench_pub_.reset(
+				new realtime_tools::RealtimePublisher<geometry_msgs::WrenchStamped>(
+						nh_, "wrench", 1));
+		tool_vel_pub_.reset(
+				new realtime_tools::RealtimePublisher<geometry_msgs::TwistStamped>(
+						nh_, "tool_velocity", 1));
+		tf_pub_.reset(
+				new realtime_tools::RealtimePublisher<tf::tfMessage>(nh_,
+						"/tf", 1));
+
+		joint_pub_->lock();
+		joint_pub_->msg_.name = robot_.getJointNames();
+		joint_pub_->msg_.position.resize(6);
+		joint_pub_->msg_.velocity.resize(6);
+		joint_pub_->msg_.effort.resize(6);
+		joint_pub_->unlock();
+
+		tool_vel_pub_->lock();
+		tool_vel_pub_->msg_.header.frame_id = base_frame_;
+		tool_vel_pub_->unlock();
+
+		tf_pub_->lock();
+		tf_pub_->msg_.transforms.resize(1);
+		tf_pub_->msg_.transforms[0].header.frame_id = base_frame_;
+		tf_pub_->msg_.transforms[0].child_frame_id = tool_frame_;
+		tf_pub_->unlock();
+	}
+
+	/*
+	 * Histogram of the trajectory start latency, one row per phase in the
+	 * order of TrajLatency::phaseName(), one column per bin of TrajLatency
+	 */
+	void publishStartLatency() {
+		std::vector<traj_latency_phase> phases =
+				robot_.traj_latency_.getPhases();
+		std_msgs::Float64MultiArray msg;
+		msg.layout.dim.resize(2);
+		msg.layout.dim[0].label = "phase";
+		msg.layout.dim[0].size = TrajLatency::PHASES;
+		msg.layout.dim[0].stride = TrajLatency::PHASES * TrajLatency::BINS;
+		msg.layout.dim[1].label = "bin";
+		msg.layout.dim[1].size = TrajLatency::BINS;
+		msg.layout.dim[1].stride = TrajLatency::BINS;
+		msg.data.reserve(TrajLatency::PHASES * TrajLatency::BINS);
+		for (unsigned int i = 0; i < phases.size(); i++)
+			msg.data.insert(msg.data.end(), phases[i].bins.begin(),
+					phases[i].bins.end());
+		latency_pub_.publish(msg);
+	}
+
+	void trajThread(TrajectorySpline spline) {
+		robot_.traj_latency_.mark(TRACE_THREAD_STARTED);
+		applyRealtimeConfig(pthread_self(), rt_config_, "Trajectory thread");
+
+		bool ok = robot_.doTraj(spline);
+		publishStartLatency();
 		if (has_goal_) {
-			result_.error_code = result_.SUCCESSFUL;
-			goal_handle_.setSucceeded(result_);
+			if (ok) {
+				result_.error_code = result_.SUCCESSFUL;
+				goal_handle_.setSucceeded(result_);
+			} else {
+				// Program upload, reverse connection or buffer underrun, see the log
+				result_.error_code = -100; //nothing is defined for this...?
+				result_.error_string =
+						"The robot did not execute the trajectory to its end";
+				goal_handle_.setAborted(result_, result_.error_string);
+				print_error(result_.error_string);
+			}
 			has_goal_ = false;
 		}
 	}
@@ -237,6 +973,7 @@ private:
 			actionlib::ServerGoalHandle<
 					control_msgs::FollowJointTrajectoryAction> gh) {
 		std::string buf;
+		robot_.traj_latency_.begin();
 		print_info("on_goal");
 		if (!robot_.sec_interface_->robot_state_->isReady()) {
 			result_.error_code = -100; //nothing is defined for this...?
@@ -352,29 +1089,60 @@ private:
 			return;
 		}
 
+		bool quintic = use_accelerations_ && has_accelerations(goal.trajectory);
 		std::vector<double> timestamps;
-		std::vector<std::vector<double> > positions, velocities;
+		std::vector<std::vector<double> > positions, velocities, accelerations;
 		if (goal.trajectory.points[0].time_from_start.toSec() != 0.) {
 			print_warning(
 					"Trajectory's first point should be the current position, with time_from_start set to 0.0 - Inserting point in malformed trajectory");
+			robot_state_rt_data state =
+					robot_.rt_interface_->robot_state_->snapshot();
 			timestamps.push_back(0.0);
 			positions.push_back(
-					robot_.rt_interface_->robot_state_->getQActual());
+					std::vector<double>(state.q_actual.begin(),
+							state.q_actual.end()));
 			velocities.push_back(
-					robot_.rt_interface_->robot_state_->getQdActual());
+					std::vector<double>(state.qd_actual.begin(),
+							state.qd_actual.end()));
+			if (quintic)
+				accelerations.push_back(
+						std::vector<double>(state.qdd_target.begin(),
+								state.qdd_target.end()));
 		}
 		for (unsigned int i = 0; i < goal.trajectory.points.size(); i++) {
 			timestamps.push_back(
 					goal.trajectory.points[i].time_from_start.toSec());
 			positions.push_back(goal.trajectory.points[i].positions);
 			velocities.push_back(goal.trajectory.points[i].velocities);
+			if (quintic)
+				accelerations.push_back(
+						goal.trajectory.points[i].accelerations);
+		}
 
+		// Interpolation coefficients are computed once, not on every servo tick
+		TrajectorySpline spline;
+		bool built;
+		if (quintic)
+			built = spline.buildQuintic(timestamps, positions, velocities,
+					accelerations);
+		else
+			built = spline.buildCubic(timestamps, positions, velocities);
+		if (!built) {
+			result_.error_code = result_.INVALID_GOAL;
+			result_.error_string = "Could not interpolate the goal trajectory";
+			gh.setRejected(result_, result_.error_string);
+			print_error(result_.error_string);
+			return;
 		}
 
+		print_debug(
+				std::string("Interpolating trajectory with ")
+						+ (quintic ? "quintic" : "cubic") + " splines");
+
+		robot_.traj_latency_.mark(TRACE_GOAL_ACCEPTED);
 		goal_handle_.setAccepted();
 		has_goal_ = true;
-		std::thread(&RosWrapper::trajThread, this, timestamps, positions,
-				velocities).detach();
+		std::thread(&RosWrapper::trajThread, this, std::move(spline)).detach();
 	}
 
 	void cancelCB(
@@ -503,10 +1271,10 @@ private:
 
 	bool start_positions_match(const trajectory_msgs::JointTrajectory &traj, double eps)
 	{
+		robot_state_rt_data state = robot_.rt_interface_->robot_state_->snapshot();
 		for (unsigned int i = 0; i < traj.points[0].positions.size(); i++)
 		{
-			std::vector<double> qActual = robot_.rt_interface_->robot_state_->getQActual();
-			if( fabs(traj.points[0].positions[i] - qActual[i]) > eps )
+			if( fabs(traj.points[0].positions[i] - state.q_actual[i]) > eps )
 			{
 				return false;
 			}
@@ -539,6 +1307,20 @@ private:
 				if (!std::isfinite(goal.trajectory.points[i].velocities[j]))
 					return false;
 			}
+			for (unsigned int j = 0;
+					j < goal.trajectory.points[i].accelerations.size(); j++) {
+				if (!std::isfinite(goal.trajectory.points[i].accelerations[j]))
+					return false;
+			}
+		}
+		return true;
+	}
+
+	bool has_accelerations(const trajectory_msgs::JointTrajectory &traj) {
+		for (unsigned int i = 0; i < traj.points.size(); i++) {
+			if (traj.points[i].accelerations.size()
+					!= traj.points[i].positions.size())
+				return false;
 		}
 		return true;
 	}
@@ -577,16 +1359,19 @@ private:
 		tool_vel_pub.msg_.header.frame_id = base_frame_;
 
 
+		robot_state_rt_data state;
+
+		applyRealtimeConfig(pthread_self(), rt_config_, "ros_control thread");
 		clock_gettime(CLOCK_MONOTONIC, &last_time);
 		while (ros::ok()) {
-			std::mutex msg_lock; // The values are locked for reading in the class, so just use a dummy mutex
-			std::unique_lock<std::mutex> locker(msg_lock);
-			while (!robot_.rt_interface_->robot_state_->getControllerUpdated()) {
-				rt_msg_cond_.wait(locker);
+			// Read the signal before the queue, so a packet queued in between wakes us
+			int seq = control_signal_.prepare();
+			if (!popRTState(state)) {
+				control_signal_.wait(seq, 100000000L);
+				continue;
 			}
 			// Input
-			hardware_interface_->read();
-			robot_.rt_interface_->robot_state_->setControllerUpdated();
+			hardware_interface_->read(state);
 
 			// Control
 			clock_gettime(CLOCK_MONOTONIC, &current_time);
@@ -599,7 +1384,7 @@ private:
 			hardware_interface_->write();
 
 			// Tool vector: Actual Cartesian coordinates of the tool: (x,y,z,rx,ry,rz), where rx, ry and rz is a rotation vector representation of the tool orientation
-			std::vector<double> tool_vector_actual = robot_.rt_interface_->robot_state_->getToolVectorActual();
+			const std::array<double, 6>& tool_vector_actual = state.tool_vector_actual;
 
 			// Compute rotation angle
 			double rx = tool_vector_actual[3];
@@ -608,7 +1393,7 @@ private:
 			double angle = std::sqrt(std::pow(rx,2) + std::pow(ry,2) + std::pow(rz,2));
 
 			// Broadcast transform
-			if( tf_pub.trylock() )
+			if( tf_rate_.due(state.time) && tf_pub.trylock() )
 			{			
 				tf_pub.msg_.transforms[0].header.stamp = ros_time;
 				if (angle < 1e-16) {
@@ -630,9 +1415,9 @@ private:
 			}
 
 			//Publish tool velocity
-			std::vector<double> tcp_speed = robot_.rt_interface_->robot_state_->getTcpSpeedActual();
+			const std::array<double, 6>& tcp_speed = state.tcp_speed_actual;
 
-			if( tool_vel_pub.trylock() )
+			if( tool_velocity_rate_.due(state.time) && tool_vel_pub.trylock() )
 			{			
 				tool_vel_pub.msg_.header.stamp = ros_time;
 				tool_vel_pub.msg_.twist.linear.x = tcp_speed[0];
@@ -647,193 +1432,196 @@ private:
 
 		}
 	}
+};
 
-	void publishRTMsg() {
-		ros::Publisher joint_pub = nh_.advertise<sensor_msgs::JointState>(
-				"joint_states", 1);
-		ros::Publisher wrench_pub = nh_.advertise<geometry_msgs::WrenchStamped>(
-				"wrench", 1);
-        ros::Publisher tool_vel_pub = nh_.advertise<geometry_msgs::TwistStamped>("tool_velocity", 1);
-        static tf::TransformBroadcaster br;
-		while (ros::ok()) {
-			sensor_msgs::JointState joint_msg;
-			joint_msg.name = robot_.getJointNames();
-			geometry_msgs::WrenchStamped wrench_msg;
-            geometry_msgs::PoseStamped tool_pose_msg;
-			std::mutex msg_lock; // The values are locked for reading in the class, so just use a dummy mutex
-			std::unique_lock<std::mutex> locker(msg_lock);
-			while (!robot_.rt_interface_->robot_state_->getDataPublished()) {
-				rt_msg_cond_.wait(locker);
-			}
-			joint_msg.header.stamp = ros::Time::now();
-			joint_msg.position =
-					robot_.rt_interface_->robot_state_->getQActual();
-			for (unsigned int i = 0; i < joint_msg.position.size(); i++) {
-				joint_msg.position[i] += joint_offsets_[i];
-			}
-			joint_msg.velocity =
-					robot_.rt_interface_->robot_state_->getQdActual();
-			joint_msg.effort = robot_.rt_interface_->robot_state_->getIActual();
-			joint_pub.publish(joint_msg);
-			std::vector<double> tcp_force =
-					robot_.rt_interface_->robot_state_->getTcpForce();
-			wrench_msg.header.stamp = joint_msg.header.stamp;
-			wrench_msg.wrench.force.x = tcp_force[0];
-			wrench_msg.wrench.force.y = tcp_force[1];
-			wrench_msg.wrench.force.z = tcp_force[2];
-			wrench_msg.wrench.torque.x = tcp_force[3];
-			wrench_msg.wrench.torque.y = tcp_force[4];
-			wrench_msg.wrench.torque.z = tcp_force[5];
-			wrench_pub.publish(wrench_msg);
-
-            // Tool vector: Actual Cartesian coordinates of the tool: (x,y,z,rx,ry,rz), where rx, ry and rz is a rotation vector representation of the tool orientation
-            std::vector<double> tool_vector_actual = robot_.rt_interface_->robot_state_->getToolVectorActual();
-
-            //Create quaternion
-            tf::Quaternion quat;
-            double rx = tool_vector_actual[3];
-            double ry = tool_vector_actual[4];
-            double rz = tool_vector_actual[5];
-            double angle = std::sqrt(std::pow(rx,2) + std::pow(ry,2) + std::pow(rz,2));
-            if (angle < 1e-16) {
-                quat.setValue(0, 0, 0, 1);
-            } else {
-                quat.setRotation(tf::Vector3(rx/angle, ry/angle, rz/angle), angle);
-            }
-
-            //Create and broadcast transform
-            tf::Transform transform;
-            transform.setOrigin(tf::Vector3(tool_vector_actual[0], tool_vector_actual[1], tool_vector_actual[2]));
-            transform.setRotation(quat);
-            br.sendTransform(tf::StampedTransform(transform, joint_msg.header.stamp, base_frame_, tool_frame_));
-
-            //Publish tool velocity
-            std::vector<double> tcp_speed =
-                    robot_.rt_interface_->robot_state_->getTcpSpeedActual();
-            geometry_msgs::TwistStamped tool_twist;
-            tool_twist.header.frame_id = base_frame_;
-            tool_twist.header.stamp = joint_msg.header.stamp;
-            tool_twist.twist.linear.x = tcp_speed[0];
-            tool_twist.twist.linear.y = tcp_speed[1];
-            tool_twist.twist.linear.z = tcp_speed[2];
-            tool_twist.twist.angular.x = tcp_speed[3];
-            tool_twist.twist.angular.y = tcp_speed[4];
-            tool_twist.twist.angular.z = tcp_speed[5];
-            tool_vel_pub.publish(tool_twist);
-
-			robot_.rt_interface_->robot_state_->setDataPublished();
+/*
+ * The publishing threads shared by every robot of the node. The drivers
+ * signal new data through the pool's condition variables, and each thread
+ * publishes for all the robots that have something new.
+ */
+class PublisherPool {
+private:
+	std::condition_variable rt_msg_cond_;
+	WakeSignal rt_signal_; //rung by the RT queues of all robots
+	std::condition_variable msg_cond_;
+	std::vector<RosWrapper*> robots_;
+	std::thread* rt_publish_thread_;
+	std::thread* mb_publish_thread_;
+	std::atomic<bool> keepalive_;
+
+	bool rtDataAvailable() {
+		for (unsigned int i = 0; i < robots_.size(); i++) {
+			if (robots_[i]->hasRTData())
+				return true;
 		}
+		return false;
 	}
 
-	void publishMbMsg() {
-		bool warned = false;
-		ros::Publisher io_pub = nh_.advertise<ur_msgs::IOStates>(
-				"ur_driver/io_states", 1);
+	bool mbDataAvailable() {
+		for (unsigned int i = 0; i < robots_.size(); i++) {
+			if (robots_[i]->hasMbData())
+				return true;
+		}
+		return false;
+	}
 
-		while (ros::ok()) {
-			ur_msgs::IOStates io_msg;
+	void publishRTMsgs() {
+		while (ros::ok() && keepalive_) {
+			// Read the signal before the queues, so a packet queued in between wakes us
+			int seq = rt_signal_.prepare();
+			if (!rtDataAvailable()) {
+				rt_signal_.wait(seq, 100000000L);
+				continue;
+			}
+			for (unsigned int i = 0; i < robots_.size(); i++) {
+				if (robots_[i]->hasRTData())
+					robots_[i]->publishRTMsg();
+			}
+		}
+	}
+
+	void publishMbMsgs() {
+		while (ros::ok() && keepalive_) {
 			std::mutex msg_lock; // The values are locked for reading in the class, so just use a dummy mutex
 			std::unique_lock<std::mutex> locker(msg_lock);
-			while (!robot_.sec_interface_->robot_state_->getNewDataAvailable()) {
-				msg_cond_.wait(locker);
-			}
-			int i_max = 10;
-			if (robot_.sec_interface_->robot_state_->getVersion() > 3.0)
-				i_max = 18; // From version 3.0, there are up to 18 inputs and outputs
-			for (unsigned int i = 0; i < i_max; i++) {
-				ur_msgs::Digital digi;
-				digi.pin = i;
-				digi.state =
-						((robot_.sec_interface_->robot_state_->getDigitalInputBits()
-								& (1 << i)) >> i);
-				io_msg.digital_in_states.push_back(digi);
-				digi.state =
-						((robot_.sec_interface_->robot_state_->getDigitalOutputBits()
-								& (1 << i)) >> i);
-				io_msg.digital_out_states.push_back(digi);
-			}
-			ur_msgs::Analog ana;
-			ana.pin = 0;
-			ana.state = robot_.sec_interface_->robot_state_->getAnalogInput0();
-			io_msg.analog_in_states.push_back(ana);
-			ana.pin = 1;
-			ana.state = robot_.sec_interface_->robot_state_->getAnalogInput1();
-			io_msg.analog_in_states.push_back(ana);
-
-			ana.pin = 0;
-			ana.state = robot_.sec_interface_->robot_state_->getAnalogOutput0();
-			io_msg.analog_out_states.push_back(ana);
-			ana.pin = 1;
-			ana.state = robot_.sec_interface_->robot_state_->getAnalogOutput1();
-			io_msg.analog_out_states.push_back(ana);
-			io_pub.publish(io_msg);
-
-			if (robot_.sec_interface_->robot_state_->isEmergencyStopped()
-					or robot_.sec_interface_->robot_state_->isProtectiveStopped()) {
-				if (robot_.sec_interface_->robot_state_->isEmergencyStopped()
-						and !warned) {
-					print_error("Emergency stop pressed!");
-				} else if (robot_.sec_interface_->robot_state_->isProtectiveStopped()
-						and !warned) {
-					print_error("Robot is protective stopped!");
-				}
-				if (has_goal_) {
-					print_error("Aborting trajectory");
-					robot_.stopTraj();
-					result_.error_code = result_.SUCCESSFUL;
-					result_.error_string = "Robot was halted";
-					goal_handle_.setAborted(result_, result_.error_string);
-					has_goal_ = false;
-				}
-				warned = true;
-			} else
-				warned = false;
+			while (!mbDataAvailable() && keepalive_) {
+				msg_cond_.wait_for(locker, std::chrono::milliseconds(100));
+			}
+			for (unsigned int i = 0; i < robots_.size(); i++) {
+				if (robots_[i]->hasMbData())
+					robots_[i]->publishMbMsg();
+			}
+		}
+	}
 
-			robot_.sec_interface_->robot_state_->finishedReading();
+public:
+	PublisherPool() :
+			rt_publish_thread_(NULL), mb_publish_thread_(NULL), keepalive_(
+					false) {
+	}
 
-		}
+	std::condition_variable& getRTMsgCond() {
+		return rt_msg_cond_;
 	}
 
+	WakeSignal* getRTSignal() {
+		return &rt_signal_;
+	}
+
+	std::condition_variable& getMsgCond() {
+		return msg_cond_;
+	}
+
+	/* All robots must be added before start() */
+	void add(RosWrapper* robot) {
+		robots_.push_back(robot);
+	}
+
+	void start() {
+		keepalive_ = true;
+		rt_publish_thread_ = new std::thread(
+				boost::bind(&PublisherPool::publishRTMsgs, this));
+		mb_publish_thread_ = new std::thread(
+				boost::bind(&PublisherPool::publishMbMsgs, this));
+	}
+
+	void halt() {
+		keepalive_ = false;
+		if (rt_publish_thread_ != NULL)
+			rt_publish_thread_->join();
+		if (mb_publish_thread_ != NULL)
+			mb_publish_thread_->join();
+	}
 };
 
+void getReversePort(std::string param, int default_port, int& reverse_port) {
+	if ((ros::param::get(param, reverse_port))) {
+		if((reverse_port <= 0) or (reverse_port >= 65535)) {
+			print_warning("Reverse port value is not valid (Use number between 1 and 65534. Using default value of " + std::to_string(default_port));
+			reverse_port = default_port;
+		}
+	} else
+		reverse_port = default_port;
+}
+
 int main(int argc, char **argv) {
 	bool use_sim_time = false;
 	std::string host;
 	int reverse_port = 50001;
+	std::vector<std::string> robot_names;
 
 	ros::init(argc, argv, "ur_driver");
 	ros::NodeHandle nh;
 	if (ros::param::get("use_sim_time", use_sim_time)) {
 		print_warning("use_sim_time is set!!");
 	}
-	if (!(ros::param::get("~robot_ip_address", host))) {
-		if (argc > 1) {
-			print_warning(
-					"Please set the parameter robot_ip_address instead of giving it as a command line argument. This method is DEPRECATED");
-			host = argv[1];
-		} else {
-			print_fatal(
-					"Could not get robot ip. Please supply it as command line parameter or on the parameter server as robot_ip");
-			exit(1);
-		}
 
-	}
-	if ((ros::param::get("~reverse_port", reverse_port))) {
-		if((reverse_port <= 0) or (reverse_port >= 65535)) {
-			print_warning("Reverse port value is not valid (Use number between 1 and 65534. Using default value of 50001");
-			reverse_port = 50001;
+	// Before any thread is started, so all their stacks are locked too
+	rt_thread_config rt_config;
+	getRealtimeConfig("~", rt_config);
+	if (rt_config.lock_memory)
+		lockMemory();
+
+	// All robots of this node share one socket thread and one publisher pool
+	UrReactor reactor;
+	reactor.start();
+	applyRealtimeConfig(reactor.getThread().native_handle(), rt_config,
+			"Socket reactor thread");
+	PublisherPool publishers;
+	std::vector<RosWrapper*> interfaces;
+
+	if (ros::param::get("~robots", robot_names) && robot_names.size() > 0) {
+		for (unsigned int i = 0; i < robot_names.size(); i++) {
+			std::string ns = "~" + robot_names[i] + "/";
+			if (!(ros::param::get(ns + "robot_ip_address", host))) {
+				print_fatal(
+						"Could not get robot ip of " + robot_names[i]
+								+ ". Please set the parameter " + ns
+								+ "robot_ip_address");
+				exit(1);
+			}
+			getReversePort(ns + "reverse_port", 50001 + i, reverse_port);
+			print_info(
+					"Starting driver for " + robot_names[i] + " at " + host
+							+ ", reverse port "
+							+ std::to_string(reverse_port));
+			interfaces.push_back(
+					new RosWrapper(host, reverse_port,
+							publishers.getRTMsgCond(), publishers.getMsgCond(),
+							publishers.getRTSignal(), &reactor, robot_names[i]));
 		}
-	} else
-		reverse_port = 50001;
+	} else {
+		if (!(ros::param::get("~robot_ip_address", host))) {
+			if (argc > 1) {
+				print_warning(
+						"Please set the parameter robot_ip_address instead of giving it as a command line argument. This method is DEPRECATED");
+				host = argv[1];
+			} else {
+				print_fatal(
+						"Could not get robot ip. Please supply it as command line parameter or on the parameter server as robot_ip");
+				exit(1);
+			}
 
-	RosWrapper interface(host, reverse_port);
+		}
+		getReversePort("~reverse_port", 50001, reverse_port);
+		interfaces.push_back(
+				new RosWrapper(host, reverse_port, publishers.getRTMsgCond(),
+						publishers.getMsgCond(), publishers.getRTSignal(),
+						&reactor));
+	}
+	for (unsigned int i = 0; i < interfaces.size(); i++)
+		publishers.add(interfaces[i]);
+	publishers.start();
 
 	ros::AsyncSpinner spinner(3);
 	spinner.start();
 
 	ros::waitForShutdown();
 
-	interface.halt();
+	for (unsigned int i = 0; i < interfaces.size(); i++)
+		interfaces[i]->halt();
+	publishers.halt();
+	reactor.halt();
 
 	exit(0);
 }
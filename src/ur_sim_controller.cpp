@@ -0,0 +1,787 @@
+/*
+ * ur_sim_controller.cpp
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ur_modern_driver/ur_sim_controller.h"
+#include "ur_modern_driver/robot_state.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <endian.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+namespace {
+const int PORTS[3] = { 30001, 30002, 30003 };
+
+double monotonicNow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void toTimespec(double t, struct timespec& ts) {
+	ts.tv_sec = (time_t) t;
+	ts.tv_nsec = (long) ((t - ts.tv_sec) * 1e9);
+}
+
+void putDouble(uint8_t* buf, int offset, double x) {
+	uint64_t q;
+	memcpy(&q, &x, sizeof(q));
+	q = htobe64(q);
+	memcpy(&buf[offset], &q, sizeof(q));
+}
+
+void putInt32(uint8_t* buf, int offset, int32_t x) {
+	uint32_t tmp = htonl((uint32_t) x);
+	memcpy(&buf[offset], &tmp, sizeof(tmp));
+}
+
+/* Numbers in a URScript call, e.g. "speedj([0.1, 0, 0, 0, 0, 0], 1.5, 0.008)" */
+std::vector<double> scriptNumbers(const std::string& line) {
+	std::vector<double> ret;
+	const char* p = line.c_str();
+	char* end;
+	while (*p) {
+		if ((*p >= '0' && *p <= '9') || *p == '-' || *p == '.') {
+			double x = strtod(p, &end);
+			if (end != p) {
+				ret.push_back(x);
+				p = end;
+				continue;
+			}
+		}
+		p++;
+	}
+	return ret;
+}
+
+std::string trim(const std::string& s) {
+	size_t b = s.find_first_not_of(" \t\r");
+	if (b == std::string::npos)
+		return "";
+	size_t e = s.find_last_not_of(" \t\r");
+	return s.substr(b, e - b + 1);
+}
+
+/* Value of "name = <number>" in a program, or def if it isn't there */
+double scriptAssignment(const std::string& program, const std::string& name,
+		double def) {
+	size_t pos = program.find(name + " = ");
+	if (pos == std::string::npos)
+		return def;
+	return strtod(program.c_str() + pos + name.size() + 3, NULL);
+}
+
+/*
+ * Offsets the simulator fills in, for the RT layouts the driver knows.
+ * The joint values are at the same place in all of them.
+ */
+struct sim_rt_layout {
+	double min_version;
+	int length;
+	int robot_mode;
+	int speed_scaling;
+	int program_state;
+};
+const sim_rt_layout SIM_RT_LAYOUTS[] = { { 1.6, 756, -1, -1, -1 }, { 1.7, 764,
+		756, -1, -1 }, { 1.8, 812, 756, -1, -1 },
+		{ 3.0, 1044, 756, 940, -1 }, { 3.2, 1060, 756, 940, 1052 }, { 3.5,
+				1108, 756, 940, 1052 } };
+const int RT_TIME = 4;
+const int RT_Q_TARGET = 12;
+const int RT_QD_TARGET = 60;
+const int RT_QDD_TARGET = 108;
+const int RT_Q_ACTUAL = 252;
+const int RT_QD_ACTUAL = 300;
+const int RT_CONTROLLER_TIMER = 740;
+}
+
+UrSimController::UrSimController(std::string host, double version,
+		int rt_rate) :
+		host_(host), version_(version), rt_rate_(rt_rate) {
+	keepalive_ = false;
+	program_running_ = false;
+	stop_program_ = false;
+	start_time_ = monotonicNow();
+	memset(&state_, 0, sizeof(state_));
+	state_.speed_until = -1.;
+	digital_outputs_ = 0;
+	analog_outputs_[0] = 0.;
+	analog_outputs_[1] = 0.;
+	for (int i = 0; i < 3; i++)
+		listen_fds_[i] = -1;
+}
+
+UrSimController::~UrSimController() {
+	halt();
+}
+
+bool UrSimController::start() {
+	for (int i = 0; i < 3; i++) {
+		if (!openListener(PORTS[i], listen_fds_[i]))
+			return false;
+	}
+	start_time_ = monotonicNow();
+	keepalive_ = true;
+	io_thread_ = std::thread(&UrSimController::runIO, this);
+	rt_thread_ = std::thread(&UrSimController::runRT, this);
+	mb_thread_ = std::thread(&UrSimController::runMb, this);
+	char buf[128];
+	sprintf(buf, "Simulated controller v%.1f on %s, RT packets at %i Hz",
+			version_, host_.c_str(), rt_rate_);
+	print_info(buf);
+	return true;
+}
+
+void UrSimController::halt() {
+	if (!keepalive_)
+		return;
+	keepalive_ = false;
+	stopProgram();
+	io_thread_.join();
+	rt_thread_.join();
+	mb_thread_.join();
+	std::lock_guard<std::mutex> lock(clients_lock_);
+	for (unsigned int i = 0; i < mb_clients_.size(); i++)
+		close(mb_clients_[i]);
+	for (unsigned int i = 0; i < rt_clients_.size(); i++)
+		close(rt_clients_[i]);
+	mb_clients_.clear();
+	rt_clients_.clear();
+	script_in_.clear();
+	program_in_.clear();
+	for (int i = 0; i < 3; i++) {
+		close(listen_fds_[i]);
+		listen_fds_[i] = -1;
+	}
+}
+
+void UrSimController::setJointPositions(const std::vector<double>& q) {
+	std::lock_guard<std::mutex> lock(state_lock_);
+	for (unsigned int j = 0; j < 6 && j < q.size(); j++) {
+		state_.q[j] = q[j];
+		state_.qd[j] = 0.;
+		state_.qdd[j] = 0.;
+	}
+}
+
+std::vector<double> UrSimController::getJointPositions() {
+	std::lock_guard<std::mutex> lock(state_lock_);
+	return std::vector<double>(state_.q, state_.q + 6);
+}
+
+bool UrSimController::isProgramRunning() {
+	std::lock_guard<std::mutex> lock(state_lock_);
+	return program_running_ || state_.speed_mode;
+}
+
+bool UrSimController::openListener(int port, int& fd) {
+	struct sockaddr_in addr;
+	int flag = 1;
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		print_fatal("Simulated controller: could not open a socket");
+		return false;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, host_.c_str(), &addr.sin_addr) != 1) {
+		print_fatal("Simulated controller: invalid address " + host_);
+		return false;
+	}
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+			|| listen(fd, 5) < 0) {
+		print_fatal(
+				"Simulated controller: could not listen on " + host_ + ":"
+						+ std::to_string(port) + ": " + strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+void UrSimController::addClient(int listen_index, int fd) {
+	uint8_t buf[128];
+	int flag = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+	std::lock_guard<std::mutex> lock(clients_lock_);
+	script_in_[fd] = "";
+	if (listen_index < 2) {
+		// The driver reads the firmware version from the first message
+		int len = buildVersionMessage(buf);
+		send(fd, buf, len, MSG_NOSIGNAL);
+		mb_clients_.push_back(fd);
+	} else {
+		rt_clients_.push_back(fd);
+	}
+	print_debug(
+			"Simulated controller: client on port "
+					+ std::to_string(PORTS[listen_index]));
+}
+
+void UrSimController::removeClient(int fd) {
+	std::lock_guard<std::mutex> lock(clients_lock_);
+	for (std::vector<int>* clients : { &mb_clients_, &rt_clients_ }) {
+		for (unsigned int i = 0; i < clients->size(); i++) {
+			if ((*clients)[i] == fd) {
+				clients->erase(clients->begin() + i);
+				break;
+			}
+		}
+	}
+	script_in_.erase(fd);
+	program_in_.erase(fd);
+	close(fd);
+}
+
+void UrSimController::sendTo(std::vector<int>& clients, const uint8_t* buf,
+		int len) {
+	std::lock_guard<std::mutex> lock(clients_lock_);
+	for (unsigned int i = 0; i < clients.size(); i++)
+		send(clients[i], buf, len, MSG_NOSIGNAL);
+}
+
+void UrSimController::runIO() {
+	std::vector<struct pollfd> fds;
+	char buf[4096];
+	while (keepalive_) {
+		fds.clear();
+		for (int i = 0; i < 3; i++) {
+			struct pollfd p = { listen_fds_[i], POLLIN, 0 };
+			fds.push_back(p);
+		}
+		{
+			std::lock_guard<std::mutex> lock(clients_lock_);
+			for (std::map<int, std::string>::iterator it = script_in_.begin();
+					it != script_in_.end(); ++it) {
+				struct pollfd p = { it->first, POLLIN, 0 };
+				fds.push_back(p);
+			}
+		}
+		if (poll(fds.data(), fds.size(), 100) <= 0)
+			continue;
+		for (unsigned int i = 0; i < fds.size(); i++) {
+			if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			if (i < 3) {
+				int fd = accept(fds[i].fd, NULL, NULL);
+				if (fd >= 0)
+					addClient(i, fd);
+				continue;
+			}
+			int n = recv(fds[i].fd, buf, sizeof(buf), 0);
+			if (n <= 0)
+				removeClient(fds[i].fd);
+			else
+				onScript(fds[i].fd, buf, n);
+		}
+	}
+}
+
+void UrSimController::onScript(int fd, const char* buf, int len) {
+	std::string& in = script_in_[fd];
+	size_t pos;
+	in.append(buf, len);
+	while ((pos = in.find('\n')) != std::string::npos) {
+		std::string line = in.substr(0, pos);
+		in.erase(0, pos + 1);
+		onScriptLine(fd, line);
+	}
+}
+
+void UrSimController::onScriptLine(int fd, const std::string& line) {
+	std::map<int, std::string>::iterator it = program_in_.find(fd);
+	std::string stripped = trim(line);
+	if (it != program_in_.end()) {
+		it->second += line + "\n";
+		// Only the end of the program itself isn't indented
+		if (line.size() > 0 && line[0] != '\t' && line[0] != ' '
+				&& stripped == "end") {
+			std::string program = it->second;
+			program_in_.erase(it);
+			if (program.compare(0, 4, "sec ") == 0)
+				runSecondaryProgram(program);
+			else
+				startProgram(program);
+		}
+		return;
+	}
+	if (stripped.compare(0, 4, "def ") == 0
+			|| stripped.compare(0, 4, "sec ") == 0) {
+		program_in_[fd] = stripped + "\n";
+		return;
+	}
+	if (!stripped.empty())
+		executeLine(stripped);
+}
+
+void UrSimController::executeLine(const std::string& line) {
+	std::vector<double> v = scriptNumbers(line);
+	if (line.compare(0, 7, "speedj(") == 0 && v.size() >= 7) {
+		// Replaces the running program like on the robot
+		stopProgram();
+		std::lock_guard<std::mutex> lock(state_lock_);
+		state_.speed_mode = true;
+		for (int j = 0; j < 6; j++)
+			state_.speed_target[j] = v[j];
+		state_.speed_acc = v[6];
+		state_.speed_until = v.size() >= 8 ? monotonicNow() + v[7] : -1.;
+	} else if (line.compare(0, 6, "stopj(") == 0 && v.size() >= 1) {
+		stopProgram();
+		stopj(v[0]);
+	} else {
+		print_debug("Simulated controller: ignoring \"" + line + "\"");
+	}
+}
+
+void UrSimController::runSecondaryProgram(const std::string& program) {
+	// Outputs are numbered like UrDriver::setDigitalOut()
+	static const struct {
+		const char* call;
+		int first_bit;
+	} DIGITAL_OUTS[] = { { "set_digital_out(", 0 }, {
+			"set_standard_digital_out(", 0 }, {
+			"set_configurable_digital_out(", 8 }, { "set_tool_digital_out(",
+			16 } };
+	size_t start = 0, end;
+	while ((end = program.find('\n', start)) != std::string::npos) {
+		std::string line = trim(program.substr(start, end - start));
+		start = end + 1;
+		std::vector<double> v = scriptNumbers(line);
+		if (v.empty())
+			continue;
+		std::lock_guard<std::mutex> lock(state_lock_);
+		for (unsigned int i = 0;
+				i < sizeof(DIGITAL_OUTS) / sizeof(DIGITAL_OUTS[0]); i++) {
+			if (line.compare(0, strlen(DIGITAL_OUTS[i].call),
+					DIGITAL_OUTS[i].call) != 0)
+				continue;
+			uint32_t bit = 1u << (DIGITAL_OUTS[i].first_bit + (int) v[0]);
+			if (line.find("True") != std::string::npos)
+				digital_outputs_ |= bit;
+			else
+				digital_outputs_ &= ~bit;
+		}
+		if ((line.compare(0, 15, "set_analog_out(") == 0
+				|| line.compare(0, 24, "set_standard_analog_out(") == 0)
+				&& v.size() >= 2 && v[0] >= 0 && v[0] < 2)
+			analog_outputs_[(int) v[0]] = v[1];
+	}
+}
+
+void UrSimController::startProgram(const std::string& program) {
+	driver_prog prog;
+	size_t pos = program.find("socket_open(\"");
+	stopProgram();
+	if (program.find("def driverProg():") != 0 || pos == std::string::npos) {
+		print_warning(
+				"Simulated controller: only driverProg() is simulated, ignoring "
+						+ program.substr(0, program.find('\n')));
+		return;
+	}
+	pos += 13;
+	prog.ip = program.substr(pos, program.find('"', pos) - pos);
+	prog.port = atoi(program.c_str() + program.find(',', pos) + 1);
+	prog.buffered = program.find("BUFFER_LEN = ") != std::string::npos;
+	prog.buffer_len = (int) scriptAssignment(program, "BUFFER_LEN", 0);
+	prog.mult = scriptAssignment(program, "MULT_jointstate", 1000000.);
+	pos = program.find("servoj(q, t=");
+	prog.servoj_time =
+			pos != std::string::npos ?
+					strtod(program.c_str() + pos + 12, NULL) : 0.008;
+	std::lock_guard<std::mutex> lock(program_lock_);
+	program_running_ = true;
+	program_thread_ = std::thread(&UrSimController::runDriverProg, this,
+			prog);
+}
+
+void UrSimController::stopProgram() {
+	std::lock_guard<std::mutex> lock(program_lock_);
+	if (!program_thread_.joinable())
+		return;
+	stop_program_ = true;
+	program_thread_.join();
+	stop_program_ = false;
+}
+
+void UrSimController::runDriverProg(driver_prog prog) {
+	/*
+	 * Runs the protocol of the driverProg() UrDriver uploaded, with the
+	 * servo thread of the script done once per servoj period between
+	 * reading frames.
+	 */
+	const int frame_ints = prog.buffered ? 2 + 6 * 4 : 5 + 6 * 4;
+	const double mult = prog.mult;
+	struct sockaddr_in addr;
+	int flag = 1;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(prog.port);
+	inet_pton(AF_INET, prog.ip.c_str(), &addr.sin_addr);
+	if (fd < 0
+			|| connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		print_warning(
+				"Simulated controller: driverProg() could not connect to "
+						+ prog.ip + ":" + std::to_string(prog.port));
+		if (fd >= 0)
+			close(fd);
+		program_running_ = false;
+		return;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+	std::vector<uint8_t> rx;
+	std::vector<int32_t> frame(frame_ints, 0), cur(frame_ints, 0);
+	bool keepalive = true;
+	// Stream mode
+	bool have_frame = false, running = false;
+	int seq = 0, index = 0;
+	// Buffered mode
+	std::vector<double> buffer(prog.buffered ? prog.buffer_len * 6 : 0);
+	long write_index = 0, read_index = 0;
+	bool done = false, started = false, servo_running = false, underrun =
+			false;
+	double q[6];
+	double deadline = monotonicNow() + prog.servoj_time;
+	uint8_t tmp[1024];
+
+	while (keepalive && !stop_program_ && keepalive_) {
+		struct timespec timeout;
+		struct pollfd p = { fd, POLLIN, 0 };
+		toTimespec(std::max(0., deadline - monotonicNow()), timeout);
+		if (ppoll(&p, 1, &timeout, NULL) > 0) {
+			int n = recv(fd, tmp, sizeof(tmp), 0);
+			if (n <= 0)
+				break;
+			rx.insert(rx.end(), tmp, tmp + n);
+		}
+		while (keepalive && rx.size() >= (size_t) frame_ints * 4) {
+			for (int i = 0; i < frame_ints; i++) {
+				uint32_t x;
+				memcpy(&x, &rx[i * 4], sizeof(x));
+				frame[i] = (int32_t) ntohl(x);
+			}
+			rx.erase(rx.begin(), rx.begin() + frame_ints * 4);
+			if (!prog.buffered) {
+				if (frame[0] != 2) {
+					print_warning(
+							"Simulated controller: driverProg: unknown frame version "
+									+ std::to_string(frame[0]));
+					keepalive = false;
+					break;
+				}
+				keepalive = frame[4] > 0;
+				cur = frame;
+				have_frame = true;
+				continue;
+			}
+			if (frame[0] == 1) {
+				for (int k = 0; k < frame[1]; k++) {
+					for (int j = 0; j < 6; j++)
+						buffer[(write_index % prog.buffer_len) * 6 + j] =
+								frame[2 + k * 6 + j] / mult;
+					write_index += 1;
+				}
+			} else if (frame[0] == 0) {
+				done = true;
+			} else if (frame[0] < 0) {
+				keepalive = false;
+				break;
+			}
+			if (!started
+					&& (write_index >= prog.buffer_len / 2 || done)) {
+				started = true;
+				servo_running = true;
+			}
+			putInt32(tmp, 0, underrun ? -1 : (int32_t) read_index);
+			send(fd, tmp, 4, MSG_NOSIGNAL);
+		}
+		if (monotonicNow() < deadline)
+			continue;
+		deadline += prog.servoj_time;
+		if (deadline < monotonicNow())
+			deadline = monotonicNow() + prog.servoj_time;
+		if (!prog.buffered) {
+			if (!have_frame)
+				continue;
+			if (cur[1] != seq) {
+				seq = cur[1];
+				index = 0;
+			} else {
+				index += 1;
+			}
+			if (index < cur[3]) {
+				for (int j = 0; j < 6; j++)
+					q[j] = cur[5 + index * 6 + j] / mult;
+				servo(q, prog.servoj_time);
+				running = true;
+			} else if (running) {
+				stopj(1.0);
+				running = false;
+			}
+		} else if (servo_running) {
+			if (write_index > read_index) {
+				servo(&buffer[(read_index % prog.buffer_len) * 6],
+						prog.servoj_time);
+				read_index += 1;
+			} else {
+				if (!done) {
+					underrun = true;
+					stopj(1.0);
+				}
+				servo_running = false;
+			}
+		}
+	}
+	// The robot stops when a program ends
+	if (running || servo_running)
+		stopj(1.0);
+	close(fd);
+	program_running_ = false;
+}
+
+void UrSimController::servo(const double* q, double dt) {
+	std::lock_guard<std::mutex> lock(state_lock_);
+	for (int j = 0; j < 6; j++) {
+		double qd = (q[j] - state_.q[j]) / dt;
+		state_.qdd[j] = (qd - state_.qd[j]) / dt;
+		state_.qd[j] = qd;
+		state_.q[j] = q[j];
+	}
+	state_.speed_mode = false;
+	state_.speed_until = monotonicNow() + dt;
+}
+
+void UrSimController::stopj(double acc) {
+	std::lock_guard<std::mutex> lock(state_lock_);
+	state_.speed_mode = true;
+	for (int j = 0; j < 6; j++)
+		state_.speed_target[j] = 0.;
+	state_.speed_acc = acc;
+	state_.speed_until = -1.;
+}
+
+void UrSimController::integrate(double dt) {
+	// Called with state_lock_ held
+	double now = monotonicNow();
+	if (!state_.speed_mode) {
+		// servoj holds the last setpoint once its period is over
+		if (now >= state_.speed_until) {
+			for (int j = 0; j < 6; j++) {
+				state_.qd[j] = 0.;
+				state_.qdd[j] = 0.;
+			}
+		}
+		return;
+	}
+	if (state_.speed_until >= 0. && now >= state_.speed_until) {
+		for (int j = 0; j < 6; j++)
+			state_.speed_target[j] = 0.;
+		state_.speed_until = -1.;
+	}
+	bool moving = false;
+	for (int j = 0; j < 6; j++) {
+		double max_change = state_.speed_acc * dt;
+		double change = state_.speed_target[j] - state_.qd[j];
+		if (change > max_change)
+			change = max_change;
+		else if (change < -max_change)
+			change = -max_change;
+		state_.q[j] += (state_.qd[j] + change / 2.) * dt;
+		state_.qd[j] += change;
+		state_.qdd[j] = change / dt;
+		if (state_.qd[j] != 0. || state_.speed_target[j] != 0.)
+			moving = true;
+	}
+	if (!moving)
+		state_.speed_mode = false;
+}
+
+void UrSimController::runRT() {
+	uint8_t buf[2048];
+	const double period = 1. / rt_rate_;
+	struct timespec ts;
+	double deadline = monotonicNow();
+	while (keepalive_) {
+		deadline += period;
+		toTimespec(deadline, ts);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+				== EINTR) {
+		}
+		int len;
+		{
+			std::lock_guard<std::mutex> lock(state_lock_);
+			integrate(period);
+			len = buildRTPacket(buf);
+		}
+		sendTo(rt_clients_, buf, len);
+		if (monotonicNow() > deadline + period)
+			deadline = monotonicNow();
+	}
+}
+
+void UrSimController::runMb() {
+	uint8_t buf[512];
+	while (keepalive_) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		int len;
+		{
+			std::lock_guard<std::mutex> lock(state_lock_);
+			len = buildStateMessage(buf);
+		}
+		sendTo(mb_clients_, buf, len);
+	}
+}
+
+uint8_t UrSimController::robotMode() {
+	if (version_ < 2.)
+		return robotStateTypeV18::ROBOT_RUNNING_MODE;
+	return robotStateTypeV30::ROBOT_MODE_RUNNING;
+}
+
+int UrSimController::buildVersionMessage(uint8_t* buf) {
+	// Laid out as RobotState::unpackRobotMessageVersion() reads it
+	const char name[] = "URControl";
+	const char build_date[] = "01-01-2016, 00:00:00";
+	int offset = 4;
+	uint64_t timestamp = 0;
+	int major = (int) version_;
+	int minor = (int) lround((version_ - major) * 10);
+	buf[offset++] = messageType::ROBOT_MESSAGE;
+	memcpy(&buf[offset], &timestamp, sizeof(timestamp));
+	offset += sizeof(timestamp);
+	buf[offset++] = (uint8_t) -1; //source
+	buf[offset++] = robotMessageType::ROBOT_MESSAGE_VERSION;
+	buf[offset++] = sizeof(name) - 1;
+	memcpy(&buf[offset], name, sizeof(name) - 1);
+	offset += sizeof(name) - 1;
+	buf[offset++] = (uint8_t) major;
+	buf[offset++] = (uint8_t) minor;
+	putInt32(buf, offset, 0); //svn revision
+	offset += 4;
+	memcpy(&buf[offset], build_date, sizeof(build_date) - 1);
+	offset += sizeof(build_date) - 1;
+	putInt32(buf, 0, offset);
+	return offset;
+}
+
+int UrSimController::buildStateMessage(uint8_t* buf) {
+	// Robot mode and masterboard data as RobotState::unpackRobotState() reads them
+	int offset = 5, start;
+	uint64_t timestamp = 0;
+	buf[4] = messageType::ROBOT_STATE;
+
+	start = offset;
+	offset += 4;
+	buf[offset++] = packageType::ROBOT_MODE_DATA;
+	memcpy(&buf[offset], &timestamp, sizeof(timestamp));
+	offset += sizeof(timestamp);
+	buf[offset++] = 1; //isRobotConnected
+	buf[offset++] = 1; //isRealRobotEnabled
+	buf[offset++] = 1; //isPowerOnRobot
+	buf[offset++] = 0; //isEmergencyStopped
+	buf[offset++] = 0; //isProtectiveStopped
+	buf[offset++] = (program_running_ || state_.speed_mode) ? 1 : 0;
+	buf[offset++] = 0; //isProgramPaused
+	buf[offset++] = robotMode();
+	if (version_ > 2.) {
+		buf[offset++] = 0; //controlMode
+		putDouble(buf, offset, 1.); //targetSpeedFraction
+		offset += 8;
+	}
+	putDouble(buf, offset, 1.); //speedScaling
+	offset += 8;
+	putInt32(buf, start, offset - start);
+
+	start = offset;
+	offset += 4;
+	buf[offset++] = packageType::MASTERBOARD_DATA;
+	if (version_ < 3.0) {
+		uint16_t bits = htons(0);
+		memcpy(&buf[offset], &bits, sizeof(bits));
+		offset += sizeof(bits);
+		bits = htons((uint16_t) digital_outputs_);
+		memcpy(&buf[offset], &bits, sizeof(bits));
+		offset += sizeof(bits);
+	} else {
+		putInt32(buf, offset, 0);
+		offset += 4;
+		putInt32(buf, offset, (int32_t) digital_outputs_);
+		offset += 4;
+	}
+	buf[offset++] = 0; //analogInputRange0
+	buf[offset++] = 0; //analogInputRange1
+	putDouble(buf, offset, 0.); //analogInput0
+	offset += 8;
+	putDouble(buf, offset, 0.); //analogInput1
+	offset += 8;
+	buf[offset++] = 0; //analogOutputDomain0
+	buf[offset++] = 0; //analogOutputDomain1
+	putDouble(buf, offset, analog_outputs_[0]);
+	offset += 8;
+	putDouble(buf, offset, analog_outputs_[1]);
+	offset += 8;
+	memset(&buf[offset], 0, 16); //temperature, voltage and currents
+	offset += 16;
+	buf[offset++] = 1; //safetyMode normal
+	buf[offset++] = 0; //masterOnOffState
+	buf[offset++] = 0; //euromap67InterfaceInstalled
+	putInt32(buf, start, offset - start);
+
+	putInt32(buf, 0, offset);
+	return offset;
+}
+
+int UrSimController::buildRTPacket(uint8_t* buf) {
+	const sim_rt_layout* layout = &SIM_RT_LAYOUTS[0];
+	for (unsigned int i = 0;
+			i < sizeof(SIM_RT_LAYOUTS) / sizeof(SIM_RT_LAYOUTS[0]); i++) {
+		if (version_ >= SIM_RT_LAYOUTS[i].min_version - 1e-6)
+			layout = &SIM_RT_LAYOUTS[i];
+	}
+	memset(buf, 0, layout->length);
+	putInt32(buf, 0, layout->length);
+	putDouble(buf, RT_TIME, monotonicNow() - start_time_);
+	for (int j = 0; j < 6; j++) {
+		putDouble(buf, RT_Q_TARGET + j * 8, state_.q[j]);
+		putDouble(buf, RT_QD_TARGET + j * 8, state_.qd[j]);
+		putDouble(buf, RT_QDD_TARGET + j * 8, state_.qdd[j]);
+		putDouble(buf, RT_Q_ACTUAL + j * 8, state_.q[j]);
+		putDouble(buf, RT_QD_ACTUAL + j * 8, state_.qd[j]);
+	}
+	putDouble(buf, RT_CONTROLLER_TIMER, 0.);
+	if (layout->robot_mode >= 0)
+		putDouble(buf, layout->robot_mode, robotMode());
+	if (layout->speed_scaling >= 0)
+		putDouble(buf, layout->speed_scaling, 1.);
+	if (layout->program_state >= 0)
+		putDouble(buf, layout->program_state,
+				(program_running_ || state_.speed_mode) ? 2. : 1.);
+	return layout->length;
+}
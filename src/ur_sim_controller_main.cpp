@@ -0,0 +1,87 @@
+/*
+ * ur_sim_controller_main.cpp
+ *
+ * Copyright 2015 Thomas Timm Andersen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Simulated UR controller, see UrSimController. Runs until interrupted.
+ *
+ * Usage: ur_sim_controller [--host 127.0.0.1] [--version 3.2] [--rate 125]
+ *                          [--q q0,q1,q2,q3,q4,q5]
+ *
+ * Several simulated robots can run side by side on different loopback
+ * addresses, e.g. --host 127.0.0.2.
+ */
+
+#include "ur_modern_driver/ur_sim_controller.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <atomic>
+
+static std::atomic<bool> g_keepalive(true);
+
+static void onSignal(int) {
+	g_keepalive = false;
+}
+
+int main(int argc, char **argv) {
+	std::string host = "127.0.0.1";
+	double version = 3.2;
+	int rate = 125;
+	std::vector<double> q = { 0., -1.57, 1.57, -1.57, -1.57, 0. };
+
+	for (int i = 1; i + 1 < argc; i += 2) {
+		if (strcmp(argv[i], "--host") == 0) {
+			host = argv[i + 1];
+		} else if (strcmp(argv[i], "--version") == 0) {
+			version = strtod(argv[i + 1], NULL);
+		} else if (strcmp(argv[i], "--rate") == 0) {
+			rate = atoi(argv[i + 1]);
+		} else if (strcmp(argv[i], "--q") == 0) {
+			char* p = argv[i + 1];
+			for (int j = 0; j < 6; j++) {
+				q[j] = strtod(p, &p);
+				if (*p == ',')
+					p++;
+			}
+		} else {
+			fprintf(stderr,
+					"Usage: %s [--host 127.0.0.1] [--version 3.2] [--rate 125] [--q q0,q1,q2,q3,q4,q5]\n",
+					argv[0]);
+			return 1;
+		}
+	}
+	if (rate <= 0) {
+		fprintf(stderr, "The RT rate must be positive\n");
+		return 1;
+	}
+
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+	signal(SIGPIPE, SIG_IGN);
+
+	UrSimController sim(host, version, rate);
+	sim.setJointPositions(q);
+	if (!sim.start())
+		return 1;
+	while (g_keepalive)
+		usleep(100000);
+	sim.halt();
+	return 0;
+}